@@ -0,0 +1,283 @@
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "molygen.h"
+
+#define LN2 0.6931471805599453
+#define PI 3.141592653589793
+#define RELEASE 0.01 // Seconds to damp a note, 60 dB
+
+
+// ------------------------------------------------------------------ MATH -----
+
+
+// Our own so that the samples do not depend on the libm at hand.
+
+static double pexp2(double y) {
+   double k = (double)(long)y;
+   if (k > y) k -= 1.0;
+   double x = (y - k) * LN2;
+   double s = 1.0;
+   double term = 1.0;
+   for (int n = 1; n < 14; n++) {
+      term *= x / n;
+      s += term;
+   }
+   for (; k > 0; k--) s *= 2.0;
+   for (; k < 0; k++) s *= 0.5;
+   return s;
+}
+
+
+static double pexp(double x) {
+   return pexp2(x / LN2);
+}
+
+
+// Sine and cosine of a phase in turns
+static void psincos(double turns, double *sn, double *cs) {
+   double q = (double)(long)(4.0 * turns + (turns >= 0 ? 0.5 : -0.5));
+   double x = 2.0 * PI * (turns - q / 4.0); // Within +-pi/4
+   double x2 = x * x;
+   double s = x;
+   double c = 1.0;
+   double ts = x;
+   double tc = 1.0;
+   for (int n = 1; n < 8; n++) {
+      ts *= -x2 / ((2 * n) * (2 * n + 1));
+      tc *= -x2 / ((2 * n - 1) * (2 * n));
+      s += ts;
+      c += tc;
+   }
+   switch (((long)q) & 3) {
+      case 0: *sn = s; *cs = c; break;
+      case 1: *sn = c; *cs = -s; break;
+      case 2: *sn = -s; *cs = -c; break;
+      case 3: *sn = -c; *cs = s; break;
+   }
+}
+
+
+// ---------------------------------------------------------------- RANDOM -----
+
+
+static uint32_t rng(uint32_t *state) {
+   *state ^= *state << 13;
+   *state ^= *state >> 17;
+   *state ^= *state << 5;
+   return *state;
+}
+
+
+static float uniform(uint32_t *state, float a, float b) {
+   return a + (b - a) * (rng(state) >> 8) / 16777216.0;
+}
+
+
+// ----------------------------------------------------------------- NOTES -----
+
+
+struct voice {
+   int on;
+   size_t index; // In the note list
+   double phase; // Turns
+   float env; // Release envelope
+   float amp[MOLYGEN_HARMONICS];
+   float gain[MOLYGEN_HARMONICS]; // Decay per sample
+};
+
+
+struct molygen {
+   struct molygen_settings s;
+   uint32_t rng;
+   size_t time;
+   size_t next; // Onset of the next note
+   int string; // String of the latest note
+   float pitch; // Latest note, MIDI note number
+   struct voice v[MOLYGEN_STRINGS];
+   struct molygen_note *notes;
+   size_t nnotes;
+   size_t maxnotes;
+};
+
+
+void molygen_defaults(struct molygen_settings *s) {
+   s->frequency = 44100;
+   s->seed = 1;
+   s->notes = 3.0;
+   s->low = 40.0; // E2, low E on a guitar
+   s->high = 84.0;
+   s->legato = 0.3;
+   s->overtone = 1.0;
+   s->pluck = 0.2;
+   s->decay = 3.0;
+   s->bends = 0.1;
+   s->vibrato = 0.2;
+   s->noise = 0.001;
+}
+
+
+float molygen_frequency(const struct molygen_note *n, size_t time, uint32_t fs) {
+   if (time < n->onset || time >= n->onset + n->length) return 0.0;
+   double t = (double)(time - n->onset);
+   double sn, cs;
+   psincos(n->rate * t / fs, &sn, &cs);
+   double halftones = n->bend * t / n->length + n->depth * sn;
+   return n->frequency * pexp2(halftones / 12.0);
+}
+
+
+// A pluck on the string. Harmonic h of a string plucked at p has the
+// amplitude sin(pi h p) / h^2. In a Karplus-Strong loop the averaging
+// filter takes about (pi h f / fs)^2 / 2 per period from harmonic h, so
+// the higher harmonics decay with h^2 on top of the overall decay.
+static void pluck(struct molygen *g, struct molygen_note *n) {
+   struct voice *v = &g->v[n->string];
+   float fs = g->s.frequency;
+   float f = n->frequency;
+   double sum = 0.0;
+   for (int h = 1; h <= MOLYGEN_HARMONICS; h++) {
+      double sn, cs;
+      psincos(0.5 * h * g->s.pluck, &sn, &cs);
+      double a = (sn < 0 ? -sn : sn) / (h * h);
+      if (h == 2) a *= g->s.overtone;
+      double rate = 6.9078 / g->s.decay + f * (PI * h * f / fs) * (PI * h * f / fs) / 2;
+      v->amp[h - 1] = a;
+      v->gain[h - 1] = pexp(-rate / fs);
+      sum += a;
+   }
+   for (int h = 0; h < MOLYGEN_HARMONICS; h++) {
+      v->amp[h] *= n->velocity / sum;
+   }
+   v->on = 1;
+   v->env = 1.0;
+   v->phase = 0.0;
+   v->index = g->nnotes - 1;
+}
+
+
+static void start_note(struct molygen *g) {
+   struct molygen_note n;
+   float ioi = uniform(&g->rng, 0.5, 1.5) / g->s.notes; // Seconds
+   float fs = g->s.frequency;
+
+   // Another string now and then, otherwise the same
+   if (uniform(&g->rng, 0.0, 1.0) < g->s.legato) {
+      int step = (rng(&g->rng) & 1) ? 1 : -1;
+      if (g->string + step < 0 || g->string + step >= MOLYGEN_STRINGS) step = -step;
+      g->string += step;
+   }
+
+   // A walk on the halftones, slightly out of tune
+   g->pitch += (int)uniform(&g->rng, -5.0, 6.0);
+   if (g->pitch < g->s.low) g->pitch = g->s.low;
+   if (g->pitch > g->s.high) g->pitch = g->s.high;
+   float cents = uniform(&g->rng, -0.1, 0.1);
+
+   n.onset = g->time;
+   n.length = (size_t)(fs * ioi * uniform(&g->rng, 1.0, 4.0));
+   n.string = g->string;
+   n.frequency = 440.0 * pexp2((g->pitch + cents - 69.0) / 12.0);
+   n.velocity = uniform(&g->rng, 0.3, 1.0);
+   n.bend = 0.0;
+   n.depth = 0.0;
+   n.rate = 0.0;
+   if (uniform(&g->rng, 0.0, 1.0) < g->s.bends) {
+      n.bend = uniform(&g->rng, -2.0, 2.0);
+   }
+   if (uniform(&g->rng, 0.0, 1.0) < g->s.vibrato) {
+      n.depth = uniform(&g->rng, 0.1, 0.5);
+      n.rate = uniform(&g->rng, 4.0, 7.0);
+   }
+
+   // The note on this string, if any, ends here
+   struct voice *v = &g->v[n.string];
+   if (v->on) {
+      struct molygen_note *old = &g->notes[v->index];
+      if (old->onset + old->length > g->time) old->length = g->time - old->onset;
+   }
+
+   if (g->nnotes == g->maxnotes) {
+      g->maxnotes = g->maxnotes ? 2 * g->maxnotes : 1024;
+      g->notes = realloc(g->notes, g->maxnotes * sizeof(struct molygen_note));
+      assert(g->notes);
+   }
+   g->notes[g->nnotes++] = n;
+   pluck(g, &n);
+   g->next = g->time + (size_t)(fs * ioi);
+}
+
+
+// --------------------------------------------------------------- EXPORTED -----
+
+
+struct molygen *molygen_new(const struct molygen_settings *s) {
+   struct molygen *g = calloc(1, sizeof(struct molygen));
+   assert(g);
+   g->s = *s;
+   g->rng = s->seed | 1;
+   g->string = MOLYGEN_STRINGS / 2;
+   g->pitch = (int)((s->low + s->high) / 2);
+   return g;
+}
+
+
+void molygen_free(struct molygen *g) {
+   free(g->notes);
+   free(g);
+}
+
+
+size_t molygen_notes(struct molygen *g, const struct molygen_note **notes) {
+   *notes = g->notes;
+   return g->nnotes;
+}
+
+
+void molygen_render(struct molygen *g, float *out, float *hex[MOLYGEN_STRINGS], size_t n) {
+   float fs = g->s.frequency;
+   float release = pexp(-6.9078 / (RELEASE * fs));
+   for (size_t i = 0; i < n; i++, g->time++) {
+      if (g->time == g->next) start_note(g);
+      float mix = 0.0;
+      for (int s = 0; s < MOLYGEN_STRINGS; s++) {
+         struct voice *v = &g->v[s];
+         float x = uniform(&g->rng, -g->s.noise, g->s.noise);
+         if (v->on) {
+            struct molygen_note *note = &g->notes[v->index];
+            size_t end = note->onset + note->length;
+            if (g->time >= end) {
+               v->env *= release;
+               if (v->env < 0.001) v->on = 0;
+            }
+            float f = molygen_frequency(note, g->time < end ? g->time : end - 1, fs);
+            v->phase += f / fs;
+            v->phase -= (double)(long)v->phase;
+
+            // sin(h phi) by the Chebyshev recursion, below Nyquist only
+            double s1, c1;
+            psincos(v->phase, &s1, &c1);
+            double sh0 = 0.0;
+            double sh = s1;
+            int hmax = (int)(fs / 2 / f);
+            if (hmax > MOLYGEN_HARMONICS) hmax = MOLYGEN_HARMONICS;
+            float y = 0.0;
+            for (int h = 0; h < hmax; h++) {
+               y += v->amp[h] * sh;
+               double next = 2.0 * c1 * sh - sh0;
+               sh0 = sh;
+               sh = next;
+            }
+            for (int h = 0; h < MOLYGEN_HARMONICS; h++) {
+               v->amp[h] *= v->gain[h];
+            }
+            x += v->env * y;
+         }
+         if (hex) hex[s][i] = x;
+         mix += x;
+      }
+      if (out) out[i] = mix;
+   }
+}
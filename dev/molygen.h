@@ -0,0 +1,62 @@
+#ifndef __MOLYGEN_H__
+#define __MOLYGEN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Synthetic guitar for testing and benchmarking the tracker.
+//
+// Plucked notes with Karplus-Strong style decay, ie every harmonic decays
+// and the higher ones decay faster, the way they do in a string loop with a
+// two point averaging filter. The score is random: pitches, strings,
+// overlaps, bends and vibrato all come from the seed. No libm in here, so
+// the same settings give the same samples on every machine, as long as no
+// multiply-add is fused (-ffp-contract=off, make gen).
+//
+// Every note is recorded, so the exact pitch of every string at every
+// sample is known afterwards, see molygen_frequency.
+
+#define MOLYGEN_STRINGS 6
+#define MOLYGEN_HARMONICS 24
+
+struct molygen_settings {
+   uint32_t frequency; // Sample rate
+   uint32_t seed;
+   float notes;        // Notes per second
+   float low;          // Lowest note, MIDI note number
+   float high;         // Highest note
+   float legato;       // Probability that the next note is on another string
+   float overtone;     // Second harmonic relative to the first, can be above 1
+   float pluck;        // Pluck position, fraction of the string length
+   float decay;        // Seconds for the fundamental to fall 60 dB
+   float bends;        // Probability of a bend
+   float vibrato;      // Probability of vibrato
+   float noise;        // Noise level
+};
+
+struct molygen_note {
+   size_t onset;       // Sample
+   size_t length;      // Samples until it is damped
+   int string;
+   float frequency;    // Hz at the onset
+   float velocity;     // 0 to 1
+   float bend;         // Halftones, reached linearly at the end of the note
+   float depth;        // Vibrato depth, halftones
+   float rate;         // Vibrato rate, Hz
+};
+
+void molygen_defaults(struct molygen_settings *s);
+struct molygen *molygen_new(const struct molygen_settings *s);
+void molygen_free(struct molygen *g);
+
+// The next n samples. The mix goes to out and, if hex is not NULL, every
+// string to its own channel. Either can be NULL.
+void molygen_render(struct molygen *g, float *out, float *hex[MOLYGEN_STRINGS], size_t n);
+
+// All notes so far, in order of onset
+size_t molygen_notes(struct molygen *g, const struct molygen_note **notes);
+
+// Exact frequency of a note at a sample, 0.0 outside the note
+float molygen_frequency(const struct molygen_note *note, size_t time, uint32_t fs);
+
+#endif
@@ -0,0 +1,151 @@
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "molygen.h"
+#include "molywav.h"
+
+char helptext[] =
+"NAME\n"
+"       molygen - synthetic guitar with exact annotations\n\n"
+"SYNOPSIS\n"
+"       molygen [options]\n\n"
+"DESCRIPTION\n"
+"       Plays a random score of plucked notes on six strings and writes it as\n"
+"       a WAV file. The same options give the same file on every machine, so\n"
+"       the files need not be stored, only the command line.\n"
+"\n"
+"       -o  Output file, gen.wav is default.\n"
+"       -x  Hexaphonic, one channel per string, else the mix in mono.\n"
+"       -a  Annotation file. All notes, then the exact frequency of every\n"
+"           string every 10 ms, 0 when the string is silent.\n"
+"\n"
+"       All following arguments each take a number (defaults in parentheses).\n"
+"\n"
+"       -s  Seed (1)\n"
+"       -t  Seconds (10)\n"
+"       -r  Sample rate (44100)\n"
+"       -n  Notes per second (3)\n"
+"       -l  Lowest note, MIDI note number (40)\n"
+"       -u  Highest note (84)\n"
+"       -g  Legato, probability of changing string (0.3)\n"
+"       -k  Second harmonic relative to the first (1)\n"
+"       -q  Pluck position, fraction of the string (0.2)\n"
+"       -d  Decay, seconds to fall 60 dB (3)\n"
+"       -b  Probability of a bend (0.1)\n"
+"       -v  Probability of vibrato (0.2)\n"
+"       -z  Noise level (0.001)\n"
+"\n";
+
+#define BSZ 1024
+#define HOP 0.01 // Seconds between pitch annotations
+
+
+void annotate(char *filename, struct molygen *g, struct molygen_settings *s, size_t len) {
+   FILE *f = fopen(filename, "w");
+   assert(f);
+   const struct molygen_note *notes;
+   size_t n = molygen_notes(g, &notes);
+
+   fprintf(f, "# onset length string frequency velocity bend depth rate\n");
+   for (size_t k = 0; k < n; k++) {
+      const struct molygen_note *p = &notes[k];
+      fprintf(f, "note %.5f %.5f %d %.3f %.3f %.3f %.3f %.3f\n",
+         (float)p->onset / s->frequency, (float)p->length / s->frequency,
+         p->string, p->frequency, p->velocity, p->bend, p->depth, p->rate);
+   }
+
+   // The notes on one string never overlap, so one pointer per string
+   size_t next[MOLYGEN_STRINGS] = {0};
+   fprintf(f, "# time frequency per string\n");
+   for (size_t h = 0; h * HOP * s->frequency < len; h++) {
+      size_t time = (size_t)(h * HOP * s->frequency);
+      fprintf(f, "pitch %.2f", h * HOP);
+      for (int c = 0; c < MOLYGEN_STRINGS; c++) {
+         float fr = 0.0;
+         for (size_t k = next[c]; k < n && notes[k].onset <= time; k++) {
+            if (notes[k].string != c) continue;
+            next[c] = k;
+            fr = molygen_frequency(&notes[k], time, s->frequency);
+         }
+         fprintf(f, " %.3f", fr);
+      }
+      fprintf(f, "\n");
+   }
+   fclose(f);
+}
+
+
+int main(int argc, char *argv[]) {
+   char *fileOut = "gen.wav";
+   char *fileAnnotation = 0;
+   int optHex = 0;
+   float seconds = 10.0;
+   struct molygen_settings s;
+   molygen_defaults(&s);
+
+   // Options
+   for (int i = 1; i < argc; i++) {
+      char *a = argv[i];
+      if (!strcmp(a, "-h")) {
+         printf("%s", helptext);
+         exit(0);
+      } else if (!strcmp(a, "-x")) {
+         optHex = 1;
+      } else if (a[0] == '-' && a[1] && !a[2] && i + 1 < argc && index("oastrnlugkqdbvz", a[1])) {
+         char *p = argv[++i];
+         switch (a[1]) {
+            case 'o': fileOut = p; break;
+            case 'a': fileAnnotation = p; break;
+            case 's': s.seed = (uint32_t)atol(p); break;
+            case 't': seconds = atof(p); break;
+            case 'r': s.frequency = (uint32_t)atol(p); break;
+            case 'n': s.notes = atof(p); break;
+            case 'l': s.low = atof(p); break;
+            case 'u': s.high = atof(p); break;
+            case 'g': s.legato = atof(p); break;
+            case 'k': s.overtone = atof(p); break;
+            case 'q': s.pluck = atof(p); break;
+            case 'd': s.decay = atof(p); break;
+            case 'b': s.bends = atof(p); break;
+            case 'v': s.vibrato = atof(p); break;
+            case 'z': s.noise = atof(p); break;
+         }
+      } else {
+         printf("There is no option %s\n", a);
+         exit(1);
+      }
+   }
+
+   // Render block by block, straight to the file
+   struct molygen *g = molygen_new(&s);
+   size_t len = (size_t)(seconds * s.frequency);
+   int nch = optHex ? MOLYGEN_STRINGS : 1;
+   float mix[BSZ];
+   float buf[MOLYGEN_STRINGS][BSZ];
+   float *hex[MOLYGEN_STRINGS];
+   for (int c = 0; c < MOLYGEN_STRINGS; c++) {
+      hex[c] = buf[c];
+   }
+   wavout_open(fileOut, s.frequency, nch);
+   for (size_t k = 0; k < len; k += BSZ) {
+      size_t n = len - k < BSZ ? len - k : BSZ;
+      molygen_render(g, mix, optHex ? hex : NULL, n);
+      for (size_t i = 0; i < n; i++) {
+         for (int c = 0; c < nch; c++) {
+            float x = (optHex ? buf[c][i] : mix[i]) * 32768.0;
+            if (x < -32767.0) x = -32767.0;
+            if (x > 32767.0) x = 32767.0;
+            int16_t y = (int16_t)x;
+            fwrite(&y, sizeof(int16_t), 1, wavout);
+         }
+      }
+   }
+   wavout_end();
+
+   if (fileAnnotation) annotate(fileAnnotation, g, &s, len);
+   molygen_free(g);
+   return 0;
+}
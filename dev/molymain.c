@@ -3,8 +3,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "molysynth.h"
+#include "molywav.h"
 
 char helptext[] =
 "NAME\n"
@@ -16,7 +21,19 @@ char helptext[] =
 "\n"
 "       -v  Verbose, print one line per processed pitch estimation.\n"
 "       -o  Output file, tmp.wav is default.\n"
-"       -p  Print info about infile."
+"       -p  Print info about infile.\n"
+"       -x  Hexaphonic, one channel per string in the infile. Only if built\n"
+"           with MOLY_HEX, as make moly does.\n"
+"       -f  Filter bank on the input instead of the synth.\n"
+"       -m  MIDI file. Analysis only, no synth and no WAV output.\n"
+"       -e  Event list on stdout. Analysis only, like -m. When a note ends\n"
+"           there is a line with its length in s, attack in ms, peak, decay\n"
+"           in dB/s, mean pitch, vibrato in cents and Hz and periodicity.\n"
+"       -j  Number of jobs. Long files are cut in silent places and the pieces\n"
+"           are run side by side. The result is the same as with one job.\n"
+"           With -a the onset detector remembers the last pitch through the\n"
+"           pauses, so there a piece often has to go on serially. All other\n"
+"           modes run in parallel.\n"
 "\n"
 "       All following arguments each take a floating point argument (defaults\n"
 "       in parentheses).\n"
@@ -24,152 +41,532 @@ char helptext[] =
 "       ### Pitch tracker\n"
 "       -t  Trig level (0.08)\n"
 "       -c  Compress (0.0)\n"
+"       -a  Attack, trig already in the audio path if not 0 (0.0)\n"
+"       -b  Bass, wavelengths up to 4 times longer if not 0 (0.0)\n"
+"       -g  Glide, pitch at block rate between the analyses if not 0 (0.0)\n"
+"       -k  Work budget per analysis in samples touched, 0 is none (0)\n"
+"       -l  Longest autocorrelation window in ms, 0 is 16 cycles (0)\n"
+"       -i  The same, that long after a trig (0)\n"
 "\n"
 "       ### Synth\n"
 "       -d  Dryvolume (0.0)\n"
 "       -w  Wetvolume (0.5)\n"
+"       -q  Resonance of the filter bank (10.0)\n"
 "\n";
 
-struct format {
-   uint16_t audioFormat;
-   uint16_t nbrChannels;
-   uint32_t frequency;
-   uint32_t bytePerSec;
-   uint16_t bytePerBlock;
-   uint16_t bitsPerSample;
-};
+#define BSZ 48
+#define PERIOD (10 * BSZ) // One analysis per 10 blocks
+#define NSTRING (MOLY_HEX ? MOLY_HEX : 1) // Input channels and MIDI channels
 
 
-struct chunk {
-   uint32_t id;
-   uint32_t size;
-   int16_t data[];
-};
+// ----------------------------------------------------------------- MIDI -----
+
 
+// Messages become notes with pitch bend, one MIDI channel per string. The
+// bend range is set to 2 halftones, and when the pitch wanders further than
+// that we start a new note. One tick is one millisecond.
 
-struct session {
-   struct format *format;
-   int16_t *p;
-   int16_t *p_end;
+#define MIDI_BENDRANGE 2.0
+#define MIDI_BENDSTEP 32 // Do not write bends smaller than this
+
+struct midichannel {
+   int note; // -1 is no note
+   int bend;
+} midich[NSTRING];
+
+// Events are kept with absolute ticks until the file is written
+struct midirec {
+   uint32_t tick;
+   uint8_t n;
+   uint8_t b[3];
 };
 
+int midievents;
+struct midirec *midirec;
+size_t midilen;
+size_t midisize;
+uint8_t *midibuf;
+size_t midibytes;
+size_t midibufsize;
+float midifrequency;
+
+
+void midi_byte(uint8_t b) {
+   if (midibytes == midibufsize) {
+      midibufsize = midibufsize ? 2 * midibufsize : 4096;
+      midibuf = realloc(midibuf, midibufsize);
+      assert(midibuf);
+   }
+   midibuf[midibytes++] = b;
+}
+
+
+void midi_delta(uint32_t delta) {
+   uint8_t v[5];
+   int n = 0;
+   do {
+      v[n++] = delta & 0x7f;
+      delta >>= 7;
+   } while (delta);
+   while (n > 1) midi_byte(v[--n] | 0x80);
+   midi_byte(v[0]);
+}
+
+
+struct midirec *midi_new(void) {
+   if (midilen == midisize) {
+      midisize = midisize ? 2 * midisize : 1024;
+      midirec = realloc(midirec, midisize * sizeof(struct midirec));
+      assert(midirec);
+   }
+   return &midirec[midilen++];
+}
+
+
+void midi_event(size_t time, int status, int d1, int d2) {
+   struct midirec *r = midi_new();
+   r->tick = (uint32_t)(1000.0 * time / midifrequency);
+   r->n = d2 >= 0 ? 3 : 2;
+   r->b[0] = status;
+   r->b[1] = d1;
+   r->b[2] = d2 >= 0 ? d2 : 0;
+}
+
+
+void midi_start(float frequency) {
+   midifrequency = frequency;
+   midilen = 0;
+   for (int c = 0; c < NSTRING; c++) {
+      midich[c].note = -1;
+      midich[c].bend = 8192;
+   }
+}
+
+
+// Notes still on at the end
+void midi_close(size_t time) {
+   for (int c = 0; c < NSTRING; c++) {
+      if (midich[c].note >= 0) {
+         midi_event(time, 0x80 | c, midich[c].note, 0);
+         if (midievents) printf("%.3f %d off %d\n", time / midifrequency, c, midich[c].note);
+      }
+   }
+}
+
+
+void midi_write(char *filename) {
+   FILE *f = fopen(filename, "wb");
+   assert(f);
+
+   // Tempo 1 s per quarter note and 1000 ticks per quarter note
+   uint8_t tempo[] = {0, 0xff, 0x51, 3, 0x0f, 0x42, 0x40};
+   for (size_t i = 0; i < sizeof(tempo); i++) midi_byte(tempo[i]);
+
+   // Bend range by RPN 0
+   for (int c = 0; c < NSTRING; c++) {
+      uint8_t rpn[] = {0, 0xb0 | c, 101, 0, 0, 0xb0 | c, 100, 0,
+         0, 0xb0 | c, 6, (int)MIDI_BENDRANGE, 0, 0xb0 | c, 38, 0};
+      for (size_t i = 0; i < sizeof(rpn); i++) midi_byte(rpn[i]);
+   }
+
+   uint32_t tick = 0;
+   for (size_t k = 0; k < midilen; k++) {
+      midi_delta(midirec[k].tick - tick);
+      tick = midirec[k].tick;
+      for (int i = 0; i < midirec[k].n; i++) midi_byte(midirec[k].b[i]);
+   }
+
+   uint8_t eot[] = {0, 0xff, 0x2f, 0};
+   for (size_t i = 0; i < sizeof(eot); i++) midi_byte(eot[i]);
+   uint8_t hdr[] = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x03, 0xe8,
+      'M', 'T', 'r', 'k', midibytes >> 24, midibytes >> 16, midibytes >> 8, midibytes};
+   fwrite(hdr, sizeof(hdr), 1, f);
+   fwrite(midibuf, midibytes, 1, f);
+   fclose(f);
+}
 
-#define BSZ 48
 
+void midi_message(struct moly_message *m, int c, size_t time) {
+   struct midichannel *ch = &midich[c];
+   int type = m->type;
+   m->type = 0; // Read, see NOTE 3 in molysynth.h
+   if (type == 0) return;
+   float t = time / midifrequency;
+
+   // The note that ended, see NOTE 7 in molysynth.h
+   struct moly_note *n = &m->note;
+   if (midievents && n->length) {
+      float pitch = n->lambda ? 69.0 + 12.0 * log2f(midifrequency / n->lambda / 440.0) : 0.0;
+      printf("%.3f %d note %.3f %.0f %.3f %.1f %.2f %.1f %.1f %.3f\n", t, c,
+         n->length / midifrequency, 1000.0 * n->attack / midifrequency, n->peak,
+         n->decay, pitch, n->vibrato, n->vibrato_rate, n->periodicity);
+   }
 
-// ------------------------------------------------------------- READ WAV -----
+   // Silence
+   if (m->volume == 0.0) {
+      if (ch->note >= 0) {
+         midi_event(time, 0x80 | c, ch->note, 0);
+         if (midievents) printf("%.3f %d off %d\n", t, c, ch->note);
+         ch->note = -1;
+         ch->bend = 8192; // As after midi_start, it is written with the next note anyway
+      }
+      return;
+   }
 
+   // Pitch in halftones, 69 is A 440 Hz
+   float pitch = 69.0 + 12.0 * log2f(midifrequency / m->lambda / 440.0);
+   if (pitch < 0.0 || pitch > 127.0) return;
 
-void *fmmap(const char *filename, size_t *size) {
-   void *buf;
-   FILE *file = fopen(filename, "rb");
-   if (!file) {
-      fprintf(stderr, "Could not open file %s\n", filename);
-      return NULL;
+   // New note
+   if (type == MOLY_MTYPE_TRIG || ch->note < 0 ||
+      fabsf(pitch - ch->note) > MIDI_BENDRANGE - 0.5) {
+      if (ch->note >= 0) {
+         midi_event(time, 0x80 | c, ch->note, 0);
+         if (midievents) printf("%.3f %d off %d\n", t, c, ch->note);
+      }
+      int velocity = (int)(254.0 * m->volume);
+      if (velocity < 1) velocity = 1;
+      if (velocity > 127) velocity = 127;
+      ch->note = (int)(pitch + 0.5);
+      ch->bend = -MIDI_BENDSTEP; // Make sure the bend is written
+      midi_event(time, 0x90 | c, ch->note, velocity);
+      if (midievents) printf("%.3f %d on %d %d\n", t, c, ch->note, velocity);
    }
-   fseek(file, 0, SEEK_END);
-   *size = ftell(file);
-   buf = malloc(*size);
-   if (buf) {
-      fseek(file, 0L, SEEK_SET);
-      fread(buf, 1, *size, file);
+
+   // Bend
+   int bend = 8192 + (int)(8192.0 * (pitch - ch->note) / MIDI_BENDRANGE);
+   if (bend < 0) bend = 0;
+   if (bend > 16383) bend = 16383;
+   if (abs(bend - ch->bend) >= MIDI_BENDSTEP) {
+      ch->bend = bend;
+      midi_event(time, 0xe0 | c, bend & 0x7f, bend >> 7);
+      if (midievents) printf("%.3f %d bend %d\n", t, c, bend);
    }
-   fclose(file);
-   return buf;
 }
 
 
-struct chunk *findChunk(struct chunk *p, uint32_t id) {
-   uint32_t n;
+// -------------------------------------------------------------- SESSION -----
+
+
+struct session *o;
+int16_t *data; // Start of the samples
+int optHex;
+int headless;
 
-   // Header
-   if (((struct chunk *)p)->id != 'FFIR') return NULL; // RIFF
-   n = ((struct chunk *)p)->size;
-   if (((uint32_t *)p)[2] != 'EVAW') return NULL; // WAVE
-   n -= 4;
-   p = (struct chunk *)((char *)p + 12);
 
-   // Run
-   while (n >= 12) {
-      // Flat layout only, no 'FORM'
-      if (p->id == id) {
-         return p;
+// Next input buffer, one string per channel in hex mode
+int readBlock(struct session *o, float inbuf[NSTRING][BSZ], int optHex) {
+   int nch = o->format->nbrChannels;
+   if (o->p > o->p_end - BSZ * nch) return 0;
+   for (int i = 0; i < BSZ; i++) {
+      for (int c = 0; c < nch; c++) {
+         if (c == 0 || (optHex && c < NSTRING)) {
+            inbuf[c][i] = (float)*o->p / 32768.0;
+         }
+         o->p++; // Skip other channels
       }
-      int32_t m = 8 + p->size;
-      if (m & 3) return NULL; // Align 4 please
-      p = (struct chunk *)((char *)p + m);
-      n -= m;
    }
-   return NULL;
+   return 1;
 }
 
 
-void wavInit(struct session *o, uint8_t *m, int optPrintInfo) {
-   struct chunk *c;
-   c = findChunk((struct chunk *)m, ' tmf'); // <fmt >
-   assert(c);
-   o->format = (struct format *)&c->data; 
-   c = findChunk((struct chunk *)m, 'atad'); // <data>
-   assert(c);
-   o->p_end = (int16_t *)((uint8_t *)&c->data + c->size);
-   o->p = c->data;
-
-   if (optPrintInfo) {
-      printf("audioFormat %d\n", o->format->audioFormat);
-      printf("nbrChannels %d\n", o->format->nbrChannels);
-      printf("frequency %d\n", o->format->frequency);
-      printf("bytePerSec %d\n", o->format->bytePerSec);
-      printf("bytePerBlock %d\n", o->format->bytePerBlock);
-      printf("bitsPerSample %d\n", o->format->bitsPerSample);
+// Run from sample start, which is a multiple of PERIOD, to the end of the
+// file. After every analysis we ask stop if we should return already.
+size_t process(size_t start, int (*stop)(size_t time)) {
+   float inbuf[NSTRING][BSZ] = {{0}};
+   float outbuf[BSZ];
+#if MOLY_HEX
+   const float *hexin[MOLY_HEX];
+   for (int s = 0; s < MOLY_HEX; s++) {
+      hexin[s] = inbuf[s];
+   }
+#endif
+   o->p = data + start * o->format->nbrChannels;
+   size_t time = start;
+   struct moly_message m;
+   size_t nm = 0;
+
+   for (;;) {
+      int k;
+      for (k = 0; k < 10 && readBlock(o, inbuf, optHex); k++) {
+
+         // Mono is all in the library, which analyzes after every 10th block
+         if (!optHex) {
+            nm = moly_process(inbuf[0], headless ? NULL : outbuf, BSZ, &m);
+            if (headless) continue;
+         }
+
+         // 2. High priority
+#if MOLY_HEX
+         if (optHex) {
+            moly_hex_addtobuf(hexin, BSZ);
+            if (headless) continue; // Only the analysis, as fast as we can
+            moly_hex_synth(hexin, outbuf, BSZ); // <-- Replace by your own synth
+         }
+#endif
+
+         // 3. Write the result to file
+         int16_t y[BSZ];
+         for (int i = 0; i < BSZ; i++) {
+            float x = outbuf[i] * 32768.0;
+            if (x < -32767.0) x = -32767.0;
+            if (x > 32767.0) x = 32767.0;
+            y[i] = (int16_t)x;
+         }
+         fwrite(y, sizeof(int16_t), BSZ, wavout);
+      }
+      time += k * BSZ;
+      if (k < 10) return time;
+
+      // 4. Low-priority
+      // To simulate a real DSP system, where the analysis is in low-priority,
+      // we run the main analyze function every 10th time which is about 100 
+      // times per second.
+      if (optHex) {
+#if MOLY_HEX
+         struct moly_message *m = moly_hex_analyze();
+         for (int s = 0; headless && s < MOLY_HEX; s++) {
+            midi_message(&m[s], s, time);
+         }
+#endif
+      } else if (headless && nm) {
+         midi_message(&m, 0, time);
+      }
+      if (stop && stop(time)) return time;
    }
 }
 
 
-// ------------------------------------------------------------ WRITE WAV -----
+// ------------------------------------------------------------- PARALLEL -----
+
+
+// The file is cut where it has been quiet for a while. Every piece but the
+// first starts WARMUP samples before its cut with a fresh state, and has
+// normally caught up with the serial run when it reaches the cut. Whether
+// it has is checked with moly_digest: the piece before runs on to the cut
+// and the two digests are compared there. If they differ the piece before
+// simply goes on, so the result is always that of one serial run.
 
+// The longest ring of the tracker, in whole periods
+#define WARMUP ((moly_warmup() + PERIOD - 1) / PERIOD * PERIOD)
+#define QUIET 0.02 // Well below the trig level
+#define QUIET_PERIODS 20 // Before a cut
 
-FILE* wavout;
-size_t wavout_here;
+#define REPORT_BEGIN 1 // Digest at the own cut
+#define REPORT_END 2 // Digest at the next cut, then wait for S(top) or G(o on)
+#define REPORT_DONE 3 // End of file
 
-void wavout_start(char *filename) {
-   wavout = fopen(filename, "wb");
-   assert(wavout);
-   fprintf(wavout, "RIFF....WAVE");
-   fwrite("fmt \x10\0\0\0\x01\0\x01\0\x44\xAC\0\0\x88\x58\x01\0\x02\0\x10\0", 
-      24, 1, wavout);
-   fprintf(wavout, "data....");
-   wavout_here = ftell(wavout);
+struct report {
+   int kind;
+   size_t time;
+   uint64_t digest;
+};
+
+int optVerbose;
+int njobs;
+size_t cut[256];
+int job; // In the worker, which one
+int jobnext; // Next cut to report
+int jobup[256]; // Pipes to the main process
+int jobdown[256]; // and back
+FILE *jobtmp[256][3]; // Stdout, WAV data and MIDI events
+FILE *devnull;
+
+
+uint64_t state_digest(void) {
+   uint64_t d = moly_digest();
+   const uint8_t *b = (const uint8_t *)midich;
+   for (size_t k = 0; k < sizeof(midich); k++) {
+      d = (d ^ b[k]) * 0x100000001b3;
+   }
+   return d;
 }
 
 
-void wavout_end(void) {
-   uint32_t filesize = (uint32_t)ftell(wavout);
-   uint32_t datasize = (uint32_t)(ftell(wavout) - wavout_here);
-   fseek(wavout, wavout_here - 4, SEEK_SET);
-   fwrite(&datasize, 4, 1, wavout);
-   fseek(wavout, 4, SEEK_SET);
-   filesize -= 8;
-   fwrite(&filesize, 4, 1, wavout);
-   fclose(wavout);
+void report(int kind, size_t time) {
+   struct report r = {kind, time, state_digest()};
+   ssize_t n = write(jobup[job], &r, sizeof(r));
+   assert(n == sizeof(r));
 }
 
 
-// -------------------------------------------------------------- SESSION -----
+// Output goes nowhere until the own cut
+void outputs(int on) {
+   fflush(stdout);
+   dup2(fileno(on ? jobtmp[job][0] : devnull), 1);
+   wavout = on ? jobtmp[job][1] : devnull;
+   midilen = 0;
+   moly_set('v', on ? optVerbose : 0);
+}
+
+
+void finish(void) {
+   fflush(stdout);
+   fflush(wavout);
+   fwrite(midirec, sizeof(struct midirec), midilen, jobtmp[job][2]);
+   fflush(jobtmp[job][2]);
+}
+
+
+int jobstop(size_t time) {
+   if (job > 0 && time == cut[job]) {
+      report(REPORT_BEGIN, time);
+      outputs(1);
+   } else if (jobnext < njobs && time == cut[jobnext]) {
+      report(REPORT_END, time);
+      char verdict = 'S';
+      ssize_t n = read(jobdown[job], &verdict, 1);
+      if (n != 1 || verdict == 'S') return 1;
+      jobnext++;
+   }
+   return 0;
+}
+
+
+void worker(void) {
+   size_t start = job ? cut[job] - WARMUP : 0;
+   moly_seek(start);
+   midi_start(o->format->frequency);
+   outputs(job == 0);
+   jobnext = job + 1;
+   size_t time = process(start, jobstop);
+   if (jobnext < njobs && time == cut[jobnext]) {
+      finish(); // Stopped, the next one takes over
+   } else {
+      if (headless) midi_close(time);
+      finish();
+      report(REPORT_DONE, time);
+   }
+   _exit(0);
+}
 
 
-struct session *newSession(char *filename, int optPrintInfo) {
+void copy(FILE *from, FILE *to) {
+   char buf[65536];
    size_t n;
-   assert(filename);
-   uint8_t *m = fmmap(filename, &n);
-   assert(m);
-   struct session *o = calloc(sizeof(struct session), 1);
-   assert(o);
-   wavInit(o, m, optPrintInfo);
-   return o;
+   rewind(from);
+   while ((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+      fwrite(buf, 1, n, to);
+   }
 }
 
 
-float optarg(char *c) {
+// Cuts at period boundaries after QUIET_PERIODS quiet periods, about evenly
+// spread. Returns the number of pieces.
+int findcuts(int jobs) {
+   int nch = o->format->nbrChannels;
+   size_t nper = (o->p_end - data) / nch / PERIOD;
+   int n = 1;
+   int quiet = 0;
+   cut[0] = 0;
+   for (size_t p = 0; p + 1 < nper && n < jobs; p++) {
+      if (quiet >= QUIET_PERIODS && p * PERIOD >= cut[n - 1] + 2 * WARMUP &&
+         p >= nper * n / jobs) {
+         cut[n++] = p * PERIOD;
+      }
+      int16_t peak = 0;
+      int16_t *x = data + p * PERIOD * nch;
+      for (int i = 0; i < PERIOD; i++) {
+         for (int c = 0; c < nch; c++) {
+            if (c == 0 || (optHex && c < NSTRING)) {
+               int16_t a = x[i * nch + c] < 0 ? -x[i * nch + c] : x[i * nch + c];
+               if (a > peak) peak = a;
+            }
+         }
+      }
+      quiet = peak < QUIET * 32768 ? quiet + 1 : 0;
+   }
+   return n;
+}
+
+
+// Returns 0 if the file is not worth cutting
+int parallel(int jobs, char *fileOut, char *fileMidi) {
+   if (jobs > 256) jobs = 256;
+   njobs = findcuts(jobs);
+   if (njobs < 2) return 0;
+
+   devnull = fopen("/dev/null", "wb");
+   assert(devnull);
+   pid_t pid[256];
+   fflush(stdout);
+   for (int k = 0; k < njobs; k++) {
+      int up[2], down[2];
+      int err = pipe(up) || pipe(down);
+      assert(!err);
+      jobup[k] = up[1];
+      jobdown[k] = down[0];
+      for (int i = 0; i < 3; i++) {
+         jobtmp[k][i] = tmpfile();
+         assert(jobtmp[k][i]);
+      }
+      pid[k] = fork();
+      assert(pid[k] >= 0);
+      if (pid[k] == 0) {
+         job = k;
+         worker();
+      }
+      jobup[k] = up[0];
+      jobdown[k] = down[1];
+   }
+
+   // Go through the cuts in order. The owner is the job whose output is the
+   // serial result right now.
+   int owner = 0;
+   int pieces[256];
+   int npieces = 0;
+   struct report r, q;
+   for (int k = 1; k < njobs; k++) {
+      ssize_t n = read(jobup[owner], &r, sizeof(r));
+      n += read(jobup[k], &q, sizeof(q));
+      assert(n == 2 * sizeof(r));
+      assert(r.kind == REPORT_END && q.kind == REPORT_BEGIN && r.time == q.time);
+      char verdict = r.digest == q.digest ? 'S' : 'G';
+      n = write(jobdown[owner], &verdict, 1);
+      assert(n == 1);
+      if (verdict == 'S') {
+         waitpid(pid[owner], NULL, 0);
+         pieces[npieces++] = owner;
+         owner = k;
+      } else {
+         kill(pid[k], SIGKILL);
+         waitpid(pid[k], NULL, 0);
+      }
+   }
+   ssize_t n = read(jobup[owner], &r, sizeof(r));
+   assert(n == sizeof(r) && r.kind == REPORT_DONE);
+   waitpid(pid[owner], NULL, 0);
+   pieces[npieces++] = owner;
+
+   // Stitch
+   if (headless) {
+      midilen = 0;
+      for (int k = 0; k < npieces; k++) {
+         copy(jobtmp[pieces[k]][0], stdout);
+         FILE *f = jobtmp[pieces[k]][2];
+         rewind(f);
+         struct midirec rec;
+         while (fread(&rec, sizeof(rec), 1, f) == 1) {
+            *midi_new() = rec;
+         }
+      }
+      if (fileMidi) midi_write(fileMidi);
+   } else {
+      wavout_open(fileOut, o->format->frequency, 1);
+      for (int k = 0; k < npieces; k++) {
+         copy(jobtmp[pieces[k]][0], stdout);
+         copy(jobtmp[pieces[k]][1], wavout);
+      }
+      wavout_end();
+   }
+   return 1;
+}
+
+
+// ------------------------------------------------------------------ MAIN -----
+
+
+float optfloat(char *c) {
    assert(('0' <= *c && *c <= '9') || *c == '.');
    float x = 0.0;
    int k = 1;
@@ -196,8 +593,12 @@ int main(int argc, char *argv[]) {
    char *fileIn = 0;
    char *fileOut = "tmp.wav";
    int optPrintInfo = 0;
-
-   moly_init(44100.0);
+   char *fileMidi = 0;
+   int optEvents = 0;
+   int optJobs = 1;
+   char opt[32]; // For moly_set, once the sample rate is known
+   float val[32];
+   int nopt = 0;
 
    // Options
    for (int i = 1; i < argc; i++) {
@@ -206,23 +607,39 @@ int main(int argc, char *argv[]) {
             printf("%s", helptext);
             exit(0);
          } else if (!strcmp(argv[i], "-v")) {
-            moly_set('v', 1.0);
+            optVerbose = 1;
          } else if (!strcmp(argv[i], "-p")) {
             optPrintInfo = 1;
+         } else if (!strcmp(argv[i], "-x") && MOLY_HEX) {
+            optHex = 1;
+         } else if (!strcmp(argv[i], "-f") && nopt < 32) {
+            opt[nopt] = 'f';
+            val[nopt++] = 1.0;
+         } else if (!strcmp(argv[i], "-e")) {
+            optEvents = 1;
+         } else if (!strcmp(argv[i], "-m")) {
+            ++i;
+            assert(i < argc);
+            fileMidi = argv[i];
          } else if (!strcmp(argv[i], "-o")) {
             ++i;
             assert(i < argc);
             fileOut = argv[i];
+         } else if (!strcmp(argv[i], "-j")) {
+            ++i;
+            assert(i < argc);
+            optJobs = atoi(argv[i]);
          } else if (argv[i][0] == '-') {
             int c = argv[i][1];
-            if (index("tcdw", c)) {
+            if (index("tcdwqabgkli", c) && nopt < 32) {
                char *p = argv[i] + 2;
                if (*p == '\0') {
                   ++i;
                   assert(i < argc);
                   p = argv[i];
                }
-               moly_set(c, optarg(p));
+               opt[nopt] = c;
+               val[nopt++] = optfloat(p);
             } else {
                goto bail;
             }
@@ -242,44 +659,33 @@ int main(int argc, char *argv[]) {
    }
 
    // Open
-   struct session *o = newSession(fileIn, optPrintInfo);
-   wavout_start(fileOut);
-
-   // Process and make a linked list of everything
-   int mycount = 0;
-   float inbuf[BSZ];
-   float outbuf[BSZ];
-   while (o->p <= o->p_end - BSZ * 2) {
-
-      // 1. Read next input buffer
-      for (int i = 0; i < BSZ; i++) {
-         inbuf[i] = (float)*o->p++ / 32768.0;
-         o->p++; // Skip other channel
-      }
-
-      // 2. High priority
-      moly_addtobuf(inbuf, BSZ);
-      moly_synth(inbuf, outbuf, BSZ); // <-- Replace by your own synth
-
-      // 3. Write the result to file
-      for (int i = 0; i < BSZ; i++) {
-         float x = outbuf[i] * 32768.0;
-         if (x < -32767.0) x = -32767.0;
-         if (x > 32767.0) x = 32767.0;
-         int16_t y = (int16_t)x;
-         fwrite(&y, sizeof(int16_t), 1, wavout);
-      }
+   o = newSession(fileIn, optPrintInfo);
+   data = o->p;
+   if (moly_init(o->format->frequency)) {
+      printf("Sample rate %u is not supported\n", o->format->frequency);
+      exit(1);
+   }
+   moly_set('v', optVerbose);
+   for (int k = 0; k < nopt; k++) {
+      moly_set(opt[k], val[k]);
+   }
+   headless = fileMidi || optEvents;
+   midievents = optEvents;
+   midi_start(o->format->frequency);
 
-      // 4. Low-priority
-      // To simulate a real DSP system, where the analysis is in low-priority,
-      // we run the main analyze function every 10th time which is about 100 
-      // times per second.
-      if (++mycount == 10) {
-         mycount = 0;
-         struct moly_message *m = moly_analyze();
-         moly_synth_message(m); // <-- Replace by your own synth
-      }
+   // Side by side
+   if (optJobs > 1 && parallel(optJobs, fileOut, fileMidi)) {
+      exit(0);
    }
 
-   wavout_end();
+   // Or all in one go
+   if (headless) {
+      size_t time = process(0, NULL);
+      midi_close(time);
+      if (fileMidi) midi_write(fileMidi);
+   } else {
+      wavout_open(fileOut, o->format->frequency, 1);
+      process(0, NULL);
+      wavout_end();
+   }
 }
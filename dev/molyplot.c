@@ -0,0 +1,412 @@
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "molysynth.h"
+#include "molywav.h"
+
+char helptext[] =
+"NAME\n"
+"       molyplot - picture of a tracker run\n\n"
+"SYNOPSIS\n"
+"       molyplot [options] wavfile\n\n"
+"DESCRIPTION\n"
+"       Runs the pitch tracker on the first channel of wavfile and draws the\n"
+"       waveform envelope on top and the pitch track below, with a red mark\n"
+"       at every trig. Grid lines are every C and a round number of seconds.\n"
+"       The file is read a block at a time and every pixel column only keeps\n"
+"       its extremes, so an hour takes seconds and little memory.\n"
+"\n"
+"       -o  Output file, plot.png is default. SVG if it ends with .svg.\n"
+"       -p  Width in pixels (1600)\n"
+"       -r  Height in pixels (480)\n"
+"\n"
+"       The tracker settings are those of moly, each takes a number.\n"
+"\n"
+"       -t  Trig level (0.08)\n"
+"       -c  Compress (0.0)\n"
+"       -a  Attack (0.0)\n"
+"       -b  Bass (0.0)\n"
+"       -g  Glide (0.0)\n"
+"       -k  Work budget (0)\n"
+"       -l  Longest autocorrelation window in ms (0)\n"
+"       -i  The same, right after a trig (0)\n"
+"\n";
+
+#define BLOCK (10 * MOLY_PERIOD) // Samples per moly_process
+#define GAP 8 // Pixels between the panels
+
+// The colors
+#define WHITE 0
+#define GRID 1
+#define WAVE 2
+#define PITCH 3
+#define TRIG 4
+
+uint8_t palette[][3] = {
+   {255, 255, 255}, {220, 220, 220}, {70, 110, 180}, {0, 0, 0}, {220, 30, 30}
+};
+char *svgcolor[] = {"#ffffff", "#dcdcdc", "#466eb4", "#000000", "#dc1e1e"};
+
+// One pixel column, reduced while streaming
+struct column {
+   float lo, hi; // Waveform
+   float nlo, nhi; // Pitch as MIDI note number
+   float last; // Pitch at the end of the column, 0 if silent
+   int trig;
+};
+
+struct column *col;
+int width = 1600;
+int height = 480;
+
+
+// ---------------------------------------------------------------- STREAM -----
+
+
+// Column of sample n
+static inline int column(size_t n, size_t frames) {
+   return (int)((uint64_t)n * width / frames);
+}
+
+
+void stream(size_t frames, uint16_t nch, uint32_t fs) {
+   static int16_t raw[BLOCK * 8];
+   static float in[BLOCK];
+   static struct moly_message m[BLOCK / MOLY_PERIOD + 1];
+   size_t n = 0;
+   while (n < frames) {
+      size_t size = wavin_read(raw, BLOCK, nch);
+      if (size == 0) break;
+      if (size > frames - n) size = frames - n;
+
+      // The waveform
+      for (size_t i = 0; i < size; i++) {
+         in[i] = raw[i * nch] / 32768.0f;
+         struct column *c = &col[column(n + i, frames)];
+         if (in[i] < c->lo) c->lo = in[i];
+         if (in[i] > c->hi) c->hi = in[i];
+      }
+
+      // The analyses, each one for the period that ends with it
+      size_t count = moly_process(in, NULL, size, m);
+      for (size_t k = 0; k < count; k++) {
+         size_t end = (n / MOLY_PERIOD + k + 1) * MOLY_PERIOD;
+         int c0 = column(end - MOLY_PERIOD, frames);
+         int c1 = column(end - 1, frames);
+         if (c1 >= width) c1 = width - 1;
+         float note = 0.0f;
+         if (m[k].volume != 0.0f && m[k].lambda != 0.0f) {
+            note = 69.0f + 12.0f * log2f(fs / m[k].lambda / 440.0f);
+         }
+         if (m[k].type == MOLY_MTYPE_TRIG) col[c0].trig = 1;
+         for (int x = c0; x <= c1; x++) {
+            struct column *c = &col[x];
+            if (note != 0.0f) {
+               if (c->nlo == 0.0f || note < c->nlo) c->nlo = note;
+               if (note > c->nhi) c->nhi = note;
+            }
+            c->last = note;
+         }
+      }
+      n += size;
+   }
+}
+
+
+// ------------------------------------------------------------------ DRAW -----
+
+
+// Everything is vertical lines, in the column order. The picture is the
+// same for PNG and SVG.
+uint8_t *image;
+FILE *svg;
+
+
+void vline(int x, int y0, int y1, int color) {
+   if (y0 > y1) {
+      int tmp = y0;
+      y0 = y1;
+      y1 = tmp;
+   }
+   if (y0 < 0) y0 = 0;
+   if (y1 >= height) y1 = height - 1;
+   if (svg) {
+      fprintf(svg, "<path d=\"M%d.5 %dV%d\" stroke=\"%s\"/>\n",
+         x, y0, y1 + 1, svgcolor[color]);
+      return;
+   }
+   for (int y = y0; y <= y1; y++) {
+      image[y * width + x] = color;
+   }
+}
+
+
+void hline(int y, int color) {
+   if (svg) {
+      fprintf(svg, "<path d=\"M0 %d.5H%d\" stroke=\"%s\"/>\n",
+         y, width, svgcolor[color]);
+      return;
+   }
+   memset(&image[y * width], color, width);
+}
+
+
+void draw(size_t frames, uint32_t fs) {
+   int h1 = (height - GAP) / 2; // Waveform panel
+   int p0 = h1 + GAP; // Pitch panel from here to the bottom
+   int ph = height - p0;
+
+   // Note range, whole octaves around what was found
+   float lo = 1000.0f, hi = 0.0f;
+   for (int x = 0; x < width; x++) {
+      if (col[x].nhi == 0.0f) continue;
+      if (col[x].nlo < lo) lo = col[x].nlo;
+      if (col[x].nhi > hi) hi = col[x].nhi;
+   }
+   if (hi == 0.0f) {
+      lo = 36.0f;
+      hi = 84.0f;
+   }
+   lo = 12.0f * floorf(lo / 12.0f);
+   hi = 12.0f * ceilf(hi / 12.0f);
+   if (hi <= lo) hi = lo + 12.0f;
+#define NOTE_Y(note) (height - 1 - (int)(((note) - lo) / (hi - lo) * (ph - 1) + 0.5f))
+
+   // Grid, a line every C and every few seconds, not more than one per
+   // hundred pixels
+   for (float note = lo; note <= hi; note += 12.0f) {
+      hline(NOTE_Y(note), GRID);
+   }
+   hline(h1 / 2, GRID);
+   static const int steps[] = {1, 2, 5, 10, 30, 60, 120, 300, 600, 1800, 3600};
+   double seconds = (double)frames / fs;
+   int step = 3600;
+   for (int k = 0; k < 11; k++) {
+      if (seconds / steps[k] <= width / 100) {
+         step = steps[k];
+         break;
+      }
+   }
+   for (int s = step; s < seconds; s += step) {
+      int x = column((size_t)s * fs, frames);
+      vline(x, 0, h1 - 1, GRID);
+      vline(x, p0, height - 1, GRID);
+   }
+
+   // Waveform and pitch. A pitch continues from the column before unless
+   // there was silence or a trig in between.
+   float prev = 0.0f;
+   for (int x = 0; x < width; x++) {
+      struct column *c = &col[x];
+      if (c->trig) {
+         vline(x, 0, h1 / 8, TRIG);
+         vline(x, p0, p0 + ph / 8, TRIG);
+      }
+      if (c->hi >= c->lo) {
+         vline(x, (int)(h1 / 2 - c->hi * (h1 / 2 - 1)), (int)(h1 / 2 - c->lo * (h1 / 2 - 1)), WAVE);
+      }
+      if (c->nhi != 0.0f) {
+         float nlo = c->nlo, nhi = c->nhi;
+         if (prev != 0.0f && !c->trig) {
+            if (prev < nlo) nlo = prev;
+            if (prev > nhi) nhi = prev;
+         }
+         vline(x, NOTE_Y(nhi), NOTE_Y(nlo), PITCH);
+      }
+      prev = c->last;
+   }
+#undef NOTE_Y
+}
+
+
+// Text in SVG, with the characters that XML reserves escaped
+void svgtext(const char *s) {
+   for (; *s; s++) {
+      if (*s == '&') fputs("&amp;", svg);
+      else if (*s == '<') fputs("&lt;", svg);
+      else if (*s == '>') fputs("&gt;", svg);
+      else if (*s == '"') fputs("&quot;", svg);
+      else if (*s == '\'') fputs("&apos;", svg);
+      else fputc(*s, svg);
+   }
+}
+
+
+// ------------------------------------------------------------------- PNG -----
+
+
+// One byte per pixel, palette colors, and deflate without compression
+// since most of it is white anyway, what matters is that it is quick.
+uint32_t crctable[256];
+
+uint32_t crc(uint32_t c, const uint8_t *p, size_t n) {
+   if (crctable[1] == 0) {
+      for (uint32_t k = 0; k < 256; k++) {
+         uint32_t v = k;
+         for (int b = 0; b < 8; b++) v = v & 1 ? 0xedb88320 ^ (v >> 1) : v >> 1;
+         crctable[k] = v;
+      }
+   }
+   c = ~c;
+   for (size_t k = 0; k < n; k++) c = crctable[(c ^ p[k]) & 0xff] ^ (c >> 8);
+   return ~c;
+}
+
+
+void put32(uint8_t *p, uint32_t x) {
+   p[0] = x >> 24;
+   p[1] = x >> 16;
+   p[2] = x >> 8;
+   p[3] = x;
+}
+
+
+void pngchunk(FILE *f, const char *type, const uint8_t *data, uint32_t n) {
+   uint8_t b[8];
+   put32(b, n);
+   memcpy(b + 4, type, 4);
+   fwrite(b, 8, 1, f);
+   fwrite(data, 1, n, f);
+   uint32_t c = crc(crc(0, (uint8_t *)type, 4), data, n);
+   put32(b, c);
+   fwrite(b, 4, 1, f);
+}
+
+
+void png_write(char *filename) {
+   FILE *f = fopen(filename, "wb");
+   assert(f);
+   fwrite("\x89PNG\r\n\x1a\n", 8, 1, f);
+   uint8_t ihdr[13];
+   put32(ihdr, width);
+   put32(ihdr + 4, height);
+   memcpy(ihdr + 8, "\x08\x03\x00\x00\x00", 5); // 8 bit palette
+   pngchunk(f, "IHDR", ihdr, 13);
+   pngchunk(f, "PLTE", palette[0], sizeof(palette));
+
+   // Rows with filter byte 0, in stored deflate blocks, in a zlib stream
+   size_t raw = (size_t)(width + 1) * height;
+   size_t nblocks = (raw + 65534) / 65535;
+   uint8_t *z = malloc(2 + raw + 5 * nblocks + 4);
+   assert(z);
+   uint8_t *p = z;
+   *p++ = 0x78;
+   *p++ = 0x01;
+   uint32_t a = 1, b = 0; // Adler-32
+   size_t left = raw;
+   for (size_t k = 0, y = 0, x = 0; k < nblocks; k++) {
+      uint16_t n = left > 65535 ? 65535 : left;
+      left -= n;
+      *p++ = left == 0;
+      *p++ = n;
+      *p++ = n >> 8;
+      *p++ = ~n;
+      *p++ = ~n >> 8;
+      for (int i = 0; i < n; i++) {
+         uint8_t v = x == 0 ? 0 : image[y * width + x - 1];
+         if (++x > (size_t)width) {
+            x = 0;
+            y++;
+         }
+         *p++ = v;
+         a = (a + v) % 65521;
+         b = (b + a) % 65521;
+      }
+   }
+   put32(p, (b << 16) | a);
+   p += 4;
+   pngchunk(f, "IDAT", z, p - z);
+   pngchunk(f, "IEND", NULL, 0);
+   fclose(f);
+   free(z);
+}
+
+
+// ------------------------------------------------------------------ MAIN -----
+
+
+int main(int argc, char *argv[]) {
+   char *fileIn = NULL;
+   char *fileOut = "plot.png";
+   char opt[32];
+   float val[32];
+   int nopt = 0;
+   for (int i = 1; i < argc; i++) {
+      char *a = argv[i];
+      if (!strcmp(a, "-h")) {
+         printf("%s", helptext);
+         exit(0);
+      } else if (a[0] == '-' && a[1] && !a[2] && i + 1 < argc && index("oprtcabgkli", a[1])) {
+         char *p = argv[++i];
+         if (a[1] == 'o') {
+            fileOut = p;
+         } else if (a[1] == 'p') {
+            width = atoi(p);
+         } else if (a[1] == 'r') {
+            height = atoi(p);
+         } else if (nopt < 32) {
+            opt[nopt] = a[1];
+            val[nopt++] = atof(p);
+         }
+      } else if (a[0] != '-' && !fileIn) {
+         fileIn = a;
+      } else {
+         printf("There is no option %s\n", a);
+         exit(1);
+      }
+   }
+   if (!fileIn || width < 1 || height < 2 * GAP) {
+      printf("%s", helptext);
+      exit(1);
+   }
+
+   struct format format;
+   size_t frames = wavin_open(fileIn, &format);
+   if (frames == 0 || format.bitsPerSample != 16) {
+      fprintf(stderr, "Could not read %s, 16 bit WAV please\n", fileIn);
+      exit(1);
+   }
+
+   if (format.nbrChannels > 8) {
+      fprintf(stderr, "At most 8 channels please\n");
+      exit(1);
+   }
+   moly_init(format.frequency);
+   for (int k = 0; k < nopt; k++) {
+      moly_set(opt[k], val[k]);
+   }
+
+   col = calloc(width, sizeof(struct column));
+   assert(col);
+   for (int x = 0; x < width; x++) {
+      col[x].lo = 1.0f;
+      col[x].hi = -1.0f;
+   }
+   stream(frames, format.nbrChannels, format.frequency);
+   fclose(wavin);
+
+   size_t len = strlen(fileOut);
+   if (len > 4 && !strcmp(fileOut + len - 4, ".svg")) {
+      svg = fopen(fileOut, "w");
+      assert(svg);
+      fprintf(svg, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" "
+         "height=\"%d\" shape-rendering=\"crispEdges\">\n", width, height);
+      fprintf(svg, "<title>");
+      svgtext(fileIn);
+      fprintf(svg, "</title>\n");
+      fprintf(svg, "<rect width=\"100%%\" height=\"100%%\" fill=\"%s\"/>\n", svgcolor[WHITE]);
+      draw(frames, format.frequency);
+      fprintf(svg, "</svg>\n");
+      fclose(svg);
+   } else {
+      image = calloc((size_t)width * height, 1);
+      assert(image);
+      draw(frames, format.frequency);
+      png_write(fileOut);
+   }
+   return 0;
+}
@@ -0,0 +1,191 @@
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "molywav.h"
+
+
+// ------------------------------------------------------------- READ WAV -----
+
+
+void *fmmap(const char *filename, size_t *size) {
+   void *buf;
+   FILE *file = fopen(filename, "rb");
+   if (!file) {
+      fprintf(stderr, "Could not open file %s\n", filename);
+      return NULL;
+   }
+   fseek(file, 0, SEEK_END);
+   *size = ftell(file);
+   buf = malloc(*size);
+   if (buf) {
+      fseek(file, 0L, SEEK_SET);
+      fread(buf, 1, *size, file);
+   }
+   fclose(file);
+   return buf;
+}
+
+
+struct chunk *findChunk(struct chunk *p, uint32_t id) {
+   uint32_t n;
+
+   // Header
+   if (((struct chunk *)p)->id != 'FFIR') return NULL; // RIFF
+   n = ((struct chunk *)p)->size;
+   if (((uint32_t *)p)[2] != 'EVAW') return NULL; // WAVE
+   n -= 4;
+   p = (struct chunk *)((char *)p + 12);
+
+   // Run
+   while (n >= 12) {
+      // Flat layout only, no 'FORM'
+      if (p->id == id) {
+         return p;
+      }
+      int32_t m = 8 + p->size;
+      if (m & 3) return NULL; // Align 4 please
+      p = (struct chunk *)((char *)p + m);
+      n -= m;
+   }
+   return NULL;
+}
+
+
+void wavInit(struct session *o, uint8_t *m, int optPrintInfo) {
+   struct chunk *c;
+   c = findChunk((struct chunk *)m, ' tmf'); // <fmt >
+   assert(c);
+   o->format = (struct format *)&c->data; 
+   c = findChunk((struct chunk *)m, 'atad'); // <data>
+   assert(c);
+   o->p_end = (int16_t *)((uint8_t *)&c->data + c->size);
+   o->p = c->data;
+
+   if (optPrintInfo) {
+      printf("audioFormat %d\n", o->format->audioFormat);
+      printf("nbrChannels %d\n", o->format->nbrChannels);
+      printf("frequency %d\n", o->format->frequency);
+      printf("bytePerSec %d\n", o->format->bytePerSec);
+      printf("bytePerBlock %d\n", o->format->bytePerBlock);
+      printf("bitsPerSample %d\n", o->format->bitsPerSample);
+   }
+}
+
+
+// A block at a time, for recordings too long to read all at once. Returns
+// the number of frames, 0 if there is no such WAV file.
+
+FILE* wavin;
+
+size_t wavin_open(char *filename, struct format *format) {
+   uint32_t head[3];
+   struct chunk c;
+   wavin = fopen(filename, "rb");
+   if (!wavin) return 0;
+   if (fread(head, 4, 3, wavin) != 3) return 0;
+   if (head[0] != 'FFIR' || head[2] != 'EVAW') return 0; // RIFF, WAVE
+   memset(format, 0, sizeof(*format));
+   while (fread(&c, 8, 1, wavin) == 1) {
+      if (c.id == 'atad') { // <data>
+         if (format->bytePerBlock == 0) return 0;
+         return c.size / format->bytePerBlock;
+      }
+      long skip = c.size + (c.size & 1);
+      if (c.id == ' tmf') { // <fmt >
+         if (fread(format, sizeof(*format), 1, wavin) != 1) return 0;
+         skip -= sizeof(*format);
+      }
+      fseek(wavin, skip, SEEK_CUR);
+   }
+   return 0;
+}
+
+
+size_t wavin_read(int16_t *buf, size_t frames, uint16_t channels) {
+   return fread(buf, 2 * channels, frames, wavin);
+}
+
+
+// ------------------------------------------------------------ WRITE WAV -----
+
+
+FILE* wavout;
+size_t wavout_here;
+
+void wavout_open(char *filename, uint32_t frequency, uint16_t channels) {
+   uint16_t bytesperblock = 2 * channels;
+   uint32_t bytepersec = bytesperblock * frequency;
+   wavout = fopen(filename, "wb");
+   assert(wavout);
+   fprintf(wavout, "RIFF....WAVE");
+   fwrite("fmt \x10\0\0\0\x01\0", 10, 1, wavout);
+   fwrite(&channels, 2, 1, wavout);
+   fwrite(&frequency, 4, 1, wavout);
+   fwrite(&bytepersec, 4, 1, wavout);
+   fwrite(&bytesperblock, 2, 1, wavout);
+   fwrite("\x10\0", 2, 1, wavout);
+   fprintf(wavout, "data....");
+   wavout_here = ftell(wavout);
+}
+
+
+void wavout_start(char *filename) {
+   wavout_open(filename, 44100, 1);
+}
+
+
+void wavout_end(void) {
+   uint32_t filesize = (uint32_t)ftell(wavout);
+   uint32_t datasize = (uint32_t)(ftell(wavout) - wavout_here);
+   fseek(wavout, wavout_here - 4, SEEK_SET);
+   fwrite(&datasize, 4, 1, wavout);
+   fseek(wavout, 4, SEEK_SET);
+   filesize -= 8;
+   fwrite(&filesize, 4, 1, wavout);
+   fclose(wavout);
+}
+
+
+// -------------------------------------------------------------- SESSION -----
+
+
+struct session *newSession(char *filename, int optPrintInfo) {
+   size_t n;
+   assert(filename);
+   uint8_t *m = fmmap(filename, &n);
+   assert(m);
+   struct session *o = calloc(sizeof(struct session), 1);
+   assert(o);
+   wavInit(o, m, optPrintInfo);
+   return o;
+}
+
+
+// ---------------------------------------------------------- WRITE FLOATS -----
+
+
+void wav_write(char *filename, const float *x, size_t n, uint32_t frequency) {
+   FILE *f = fopen(filename, "wb");
+   assert(f);
+   uint32_t datasize = 2 * n;
+   uint32_t filesize = 36 + datasize;
+   uint32_t bytepersec = 2 * frequency;
+   fwrite("RIFF", 4, 1, f);
+   fwrite(&filesize, 4, 1, f);
+   fwrite("WAVEfmt \x10\0\0\0\x01\0\x01\0", 16, 1, f);
+   fwrite(&frequency, 4, 1, f);
+   fwrite(&bytepersec, 4, 1, f);
+   fwrite("\x02\0\x10\0data", 8, 1, f);
+   fwrite(&datasize, 4, 1, f);
+   for (size_t i = 0; i < n; i++) {
+      float y = x[i] * 32768.0;
+      if (y < -32767.0) y = -32767.0;
+      if (y > 32767.0) y = 32767.0;
+      int16_t v = (int16_t)y;
+      fwrite(&v, sizeof(int16_t), 1, f);
+   }
+   fclose(f);
+}
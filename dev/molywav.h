@@ -0,0 +1,54 @@
+#ifndef __MOLYWAV_H__
+#define __MOLYWAV_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Reading and writing WAV files for the off-line tools
+
+struct format {
+   uint16_t audioFormat;
+   uint16_t nbrChannels;
+   uint32_t frequency;
+   uint32_t bytePerSec;
+   uint16_t bytePerBlock;
+   uint16_t bitsPerSample;
+};
+
+
+struct chunk {
+   uint32_t id;
+   uint32_t size;
+   int16_t data[];
+};
+
+
+struct session {
+   struct format *format;
+   int16_t *p;
+   int16_t *p_end;
+};
+
+
+// Read
+void *fmmap(const char *filename, size_t *size);
+struct chunk *findChunk(struct chunk *p, uint32_t id);
+void wavInit(struct session *o, uint8_t *m, int optPrintInfo);
+struct session *newSession(char *filename, int optPrintInfo);
+
+// Or read a block at a time, interleaved channels, from wavin
+extern FILE* wavin;
+size_t wavin_open(char *filename, struct format *format); // Returns frames
+size_t wavin_read(int16_t *buf, size_t frames, uint16_t channels);
+
+// Write 16 bit, one sample at a time to wavout. Mono at 44.1 kHz with
+// wavout_start, any rate and interleaved channels with wavout_open.
+extern FILE* wavout;
+void wavout_start(char *filename);
+void wavout_open(char *filename, uint32_t frequency, uint16_t channels);
+void wavout_end(void);
+
+// Write a whole buffer of floats, 16 bit mono
+void wav_write(char *filename, const float *x, size_t n, uint32_t frequency);
+
+#endif
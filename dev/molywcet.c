@@ -0,0 +1,283 @@
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "molysynth.h"
+#include "molywav.h"
+
+char helptext[] =
+"NAME\n"
+"       molywcet - hunt for the worst case of moly_analyze\n\n"
+"SYNOPSIS\n"
+"       molywcet [options]\n\n"
+"DESCRIPTION\n"
+"       Generates signals that are meant to be hard for the tracker, runs the\n"
+"       tracker on them and keeps, for every family, the one with the most\n"
+"       expensive single analysis. First random candidates from every family,\n"
+"       then mutations of the worst ones found so far. The worst are saved as\n"
+"       WAV files, eg wcet-noise.wav, so that they can be rerun with moly.\n"
+"\n"
+"       The cost is counted in samples touched (see struct moly_stats), which\n"
+"       is the same on every machine. The time is also shown.\n"
+"\n"
+"       Families:\n"
+"          noise     Low-passed noise, lots of crossings\n"
+"          harmonic  Many harmonics with random phases\n"
+"          steady    Steady tone near LAMBDA_MAX, long windows\n"
+"          retrig    Plucks in rapid succession\n"
+"          vibrato   Wide fast vibrato, the index has to start over\n"
+"\n"
+"       -n  Number of candidates to try (2000).\n"
+"       -s  Random seed (1).\n"
+"       -o  Prefix of saved WAV files, wcet is default.\n"
+"\n";
+
+#define FS 44100
+#define BSZ 48
+#define PERIOD (10 * BSZ) // Analysis period as in molymain
+#define LEAD (FS / 2) // Silence before each candidate
+#define LEN (3 * FS / 2) // Length of each candidate
+#define NFAMILY 5
+#define NPARAM 4
+
+char *familyname[NFAMILY] = {"noise", "harmonic", "steady", "retrig", "vibrato"};
+
+struct candidate {
+   int family;
+   float p[NPARAM];
+   uint32_t seed;
+
+   // The most expensive analysis
+   int work;
+   struct moly_stats stats;
+   double usec;
+   size_t at; // Sample where it happened
+};
+
+
+// ---------------------------------------------------------------- RANDOM -----
+
+
+uint32_t rngstate = 1;
+
+uint32_t rng(void) {
+   rngstate ^= rngstate << 13;
+   rngstate ^= rngstate >> 17;
+   rngstate ^= rngstate << 5;
+   return rngstate;
+}
+
+float uniform(float a, float b) {
+   return a + (b - a) * (rng() >> 8) / 16777216.0;
+}
+
+
+// --------------------------------------------------------------- SIGNALS -----
+
+
+// Parameters are drawn fresh for a family, or nudged by mutate.
+void randomize(struct candidate *c, int family) {
+   memset(c, 0, sizeof(*c));
+   c->family = family;
+   c->seed = rng() | 1;
+   switch (family) {
+      case 0: // amplitude, smoothing
+         c->p[0] = uniform(0.05, 1.0);
+         c->p[1] = uniform(0.0, 0.98);
+         break;
+      case 1: // lambda, harmonics, amplitude
+         c->p[0] = uniform(30, 550);
+         c->p[1] = uniform(1, 40);
+         c->p[2] = uniform(0.1, 1.0);
+         break;
+      case 2: // lambda, amplitude
+         c->p[0] = uniform(400, 560);
+         c->p[1] = uniform(0.1, 1.0);
+         break;
+      case 3: // interval ms, lambda low, lambda high, decay per second
+         c->p[0] = uniform(10, 100);
+         c->p[1] = uniform(30, 550);
+         c->p[2] = uniform(30, 550);
+         c->p[3] = uniform(0.5, 20);
+         break;
+      case 4: // lambda, depth, rate Hz
+         c->p[0] = uniform(30, 550);
+         c->p[1] = uniform(0.0, 0.2);
+         c->p[2] = uniform(1, 30);
+         break;
+   }
+}
+
+
+void mutate(struct candidate *c) {
+   struct candidate fresh;
+   randomize(&fresh, c->family);
+   int k = rng() % NPARAM;
+   float w = uniform(0.0, 0.3);
+   c->p[k] = (1.0 - w) * c->p[k] + w * fresh.p[k];
+   if (rng() & 1) c->seed = fresh.seed;
+}
+
+
+void render(struct candidate *c, float *x) {
+   uint32_t keep = rngstate;
+   rngstate = c->seed;
+   memset(x, 0, LEAD * sizeof(float));
+   x += LEAD;
+   float y = 0.0;
+   float phi = 0.0;
+   float lambda = 0.0;
+   float amp = 0.0;
+   for (int i = 0; i < LEN; i++) {
+      float v = 0.0;
+      switch (c->family) {
+         case 0:
+            y = c->p[1] * y + (1.0 - c->p[1]) * uniform(-1.0, 1.0);
+            v = c->p[0] * y / (1.0 - c->p[1] + 0.05);
+            break;
+         case 1:
+            for (int h = 1; h <= (int)c->p[1]; h++) {
+               v += sinf(2 * M_PI * h * i / c->p[0] + h * h) / (int)c->p[1];
+            }
+            v *= c->p[2];
+            break;
+         case 2:
+            v = c->p[1] * sinf(2 * M_PI * i / c->p[0]);
+            break;
+         case 3:
+            if (i % (int)(c->p[0] * FS / 1000) == 0) {
+               lambda = uniform(c->p[1], c->p[2]);
+               amp = uniform(0.3, 1.0);
+               phi = 0.0;
+            }
+            amp *= 1.0 - c->p[3] / FS;
+            phi += 1.0 / lambda;
+            phi -= (int)phi;
+            v = amp * (sinf(2 * M_PI * phi) + 0.7 * sinf(4 * M_PI * phi));
+            break;
+         case 4:
+            lambda = c->p[0] * (1.0 + c->p[1] * sinf(2 * M_PI * c->p[2] * i / FS));
+            phi += 1.0 / lambda;
+            phi -= (int)phi;
+            v = 0.5 * (sinf(2 * M_PI * phi) + 0.5 * sinf(4 * M_PI * phi));
+            break;
+      }
+      x[i] = v;
+   }
+   rngstate = keep;
+}
+
+
+// --------------------------------------------------------------- MEASURE -----
+
+
+int work(struct moly_stats *s) {
+   return s->update + s->raw + s->index + s->acf;
+}
+
+
+double now(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+void evaluate(struct candidate *c, float *x) {
+   render(c, x);
+   moly_reset(); // Every candidate from the same fresh start
+   moly_init(FS);
+   c->work = -1;
+   c->usec = 0.0;
+   for (size_t k = 0; k + PERIOD <= LEAD + LEN; k += PERIOD) {
+      for (int b = 0; b < PERIOD; b += BSZ) {
+         moly_addtobuf(x + k + b, BSZ);
+      }
+      double t0 = now();
+      moly_analyze();
+      double usec = now() - t0;
+      if (k < LEAD) continue;
+      if (usec > c->usec) c->usec = usec;
+      if (work(&moly_stats) > c->work) {
+         c->work = work(&moly_stats);
+         c->stats = moly_stats;
+         c->at = k + PERIOD;
+      }
+   }
+}
+
+
+// ------------------------------------------------------------------ MAIN -----
+
+
+int main(int argc, char *argv[]) {
+   int ncand = 2000;
+   char *prefix = "wcet";
+
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-h")) {
+         printf("%s", helptext);
+         exit(0);
+      } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+         ncand = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+         rngstate = (uint32_t)atoi(argv[++i]) | 1;
+      } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+         prefix = argv[++i];
+      } else {
+         printf("There is no option %s\n", argv[i]);
+         exit(1);
+      }
+   }
+
+   float *x = malloc((LEAD + LEN) * sizeof(float));
+   assert(x);
+   struct candidate worst[NFAMILY];
+   for (int f = 0; f < NFAMILY; f++) {
+      worst[f].work = -1;
+   }
+
+   // First a fair share of random candidates from every family, then we
+   // spend the rest mutating the worst ones. Only families that have been
+   // evaluated are mutated, so at least one of each goes first.
+   for (int i = 0; i < ncand; i++) {
+      struct candidate c;
+      if (i < ncand / 2 || i < NFAMILY) {
+         randomize(&c, i % NFAMILY);
+      } else {
+         c = worst[rng() % NFAMILY];
+         mutate(&c);
+      }
+      evaluate(&c, x);
+      if (c.work > worst[c.family].work) {
+         worst[c.family] = c;
+      }
+   }
+
+   // Report and save, the worst first
+   printf("family      work  update    raw  index    acf    usec     at  params\n");
+   for (int n = 0; n < NFAMILY; n++) {
+      struct candidate *c = &worst[0];
+      for (int f = 1; f < NFAMILY; f++) {
+         if (worst[f].work > c->work) c = &worst[f];
+      }
+      if (c->work < 0) break; // Not evaluated, or reported
+      printf("%-8s %7d %7d %6d %6d %6d %7.1f %6.2f ",
+         familyname[c->family], c->work,
+         c->stats.update, c->stats.raw, c->stats.index, c->stats.acf,
+         c->usec, (float)c->at / FS);
+      for (int k = 0; k < NPARAM; k++) printf(" %.4g", c->p[k]);
+      printf("\n");
+
+      char filename[256];
+      snprintf(filename, sizeof(filename), "%s-%s.wav", prefix, familyname[c->family]);
+      render(c, x);
+      wav_write(filename, x, LEAD + LEN, FS);
+      c->work = -2; // Reported
+   }
+   return 0;
+}
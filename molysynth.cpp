@@ -18,9 +18,12 @@
 // #include "daisysp-lgpl.h"
 
 // ======================================= Yes, we drag in the C file here! ===
+#define MOLY_SAMPLE_RATE 48000
+#define MOLY_BLOCK_SIZE 48
 extern "C" {
 #include "src/molysynth.c"
 }
+#include "src/molysynth.hpp"
 // ============================================================================
 
 #include "daisysp.h"
@@ -35,6 +38,7 @@ Hothouse hw;
 Led led_bypass;
 bool bypass = true;
 int mytimer = 10;
+moly::Tracker<MOLY_SAMPLE_RATE, MOLY_BLOCK_SIZE, 30, 550> moly_tracker;
 
 
 void AudioCallback(
@@ -53,8 +57,8 @@ void AudioCallback(
   }
 
   // The real stuff
-  moly_addtobuf(in[0], size);
-  moly_synth(in[0], out[0], size);
+  moly_tracker.addtobuf(in[0]);
+  moly_tracker.synth(in[0], out[0]);
   for (size_t i = 0; i < size; i++) {
     out[1][i] = out[0][i];
   }
@@ -65,9 +69,8 @@ int main() {
 
   // Init
   hw.Init();
-  hw.SetAudioBlockSize(48);
+  hw.SetAudioBlockSize(moly_tracker.block_size);
   hw.SetAudioSampleRate(SaiHandle::Config::SampleRate::SAI_48KHZ);
-  moly_init(48000);
 
   // Callback
   hw.StartAdc();
@@ -75,10 +78,10 @@ int main() {
 
   while (true) {
     hw.ProcessAllControls();
-    moly_set(MOLY_TRIGLEVEL, 0.1 * hw.knobs[0].Process());
-    moly_set(MOLY_DRYVOLUME, 2.0 * hw.knobs[1].Process());
-    moly_set(MOLY_WETVOLUME, hw.knobs[2].Process());
-    moly_set(MOLY_COMPLEVEL, hw.knobs[3].Process());
+    moly_tracker.set(MOLY_TRIGLEVEL, 0.1 * hw.knobs[0].Process());
+    moly_tracker.set(MOLY_DRYVOLUME, 2.0 * hw.knobs[1].Process());
+    moly_tracker.set(MOLY_WETVOLUME, hw.knobs[2].Process());
+    moly_tracker.set(MOLY_COMPLEVEL, hw.knobs[3].Process());
     bypass ^= hw.switches[Hothouse::FOOTSWITCH_2].RisingEdge();
     led_bypass.Set(bypass ? 0.0f : 1.0f);
     led_bypass.Update();
@@ -89,7 +92,7 @@ int main() {
     // Main workload; we call this every 10*48 samples, ie 100 times per second
     hw.DelayMs(mytimer);
     mytimer = 10;
-    moly_analyze();
+    moly_tracker.analyze();
   }
 
   return 0;
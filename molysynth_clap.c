@@ -0,0 +1,506 @@
+// Molysynth as a CLAP plugin
+// Copyright (C) 2025 Anders Holtsberg <anders.holtsberg@gmail.com>
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+
+// The same tracker and mini synth as on the Hothouse, for a DAW or a live
+// rig. Build it with the CLAP headers next to this tree, see make clap in
+// dev, and try it with any host, eg clap-validator or clap-host.
+//
+// Every plugin instance is a molysynth instance of its own, allocated when
+// the host creates the plugin. On the audio thread nothing is allocated and
+// nothing is locked: moly_process takes whatever block size the host has
+// and runs the analysis inline every MOLY_PERIOD samples, within a work
+// budget, see BUDGET. The controls are the knobs of the Hothouse, with the
+// same ranges. The tracker runs at 44.1 or 48 kHz, and at a multiple of
+// that, eg 96 kHz, on every second sample.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <clap/clap.h>
+
+// ======================================= Yes, we drag in the C file here! ===
+#define MOLY_INSTANCES 1
+#include "src/molysynth.c"
+// ============================================================================
+
+
+//================================================================== PARAMS ===
+
+
+#define PARAM_TRIGLEVEL 0
+#define PARAM_DRYVOLUME 1
+#define PARAM_WETVOLUME 2
+#define PARAM_COMPLEVEL 3
+#define PARAM_BYPASS 4
+#define NPARAMS 5
+
+static const struct {
+   const char *name;
+   char opt; // For moly_set, 0 if the plugin does it, see render
+   float min, max, def;
+} params[NPARAMS] = {
+   {"Trigger level", MOLY_TRIGLEVEL, 0.0f, 0.1f, 0.08f},
+   {"Dry volume", 0, 0.0f, 2.0f, 0.0f},
+   {"Wet volume", MOLY_WETVOLUME, 0.0f, 1.0f, 0.5f},
+   {"Compression level", MOLY_COMPLEVEL, 0.0f, 1.0f, 0.0f},
+   {"Bypass", 0, 0.0f, 1.0f, 0.0f},
+};
+
+#define QUEUE_SIZE 32 // Loaded values on their way, see state_load
+
+struct plugin {
+   clap_plugin_t plugin;
+   const clap_host_t *host;
+   void *moly; // moly_size() bytes
+   uint32_t sample_rate; // Of the tracker
+   uint32_t factor; // Host samples per tracker sample, see render_down
+   uint32_t fill; // Host samples so far of the current tracker sample
+   float sum; // Of those
+   float held; // The last synth sample, repeated factor times
+   float value[NPARAMS];
+   bool active; // Main thread only
+   struct {
+      clap_id id;
+      float value;
+   } queue[QUEUE_SIZE];
+   atomic_uint head; // Written by the main thread only
+   atomic_uint tail; // Written by the audio thread only
+};
+
+
+static void param_set(struct plugin *p, clap_id id, double value) {
+   if (id >= NPARAMS) return;
+   if (value < params[id].min) value = params[id].min;
+   if (value > params[id].max) value = params[id].max;
+   p->value[id] = (float)value;
+   if (params[id].opt) {
+      moly_select(p->moly);
+      moly_set(params[id].opt, p->value[id]);
+   }
+}
+
+
+static void param_events(struct plugin *p, const clap_input_events_t *in, uint32_t i) {
+   const clap_event_header_t *h = in->get(in, i);
+   if (h->space_id != CLAP_CORE_EVENT_SPACE_ID || h->type != CLAP_EVENT_PARAM_VALUE) {
+      return;
+   }
+   const clap_event_param_value_t *ev = (const clap_event_param_value_t *)h;
+   param_set(p, ev->param_id, ev->value);
+}
+
+
+// A loaded state, see state_load. On the audio thread, or wherever flush is
+// called.
+static void queue_drain(struct plugin *p) {
+   unsigned tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+   unsigned head = atomic_load_explicit(&p->head, memory_order_acquire);
+   for (; tail != head; tail++) {
+      param_set(p, p->queue[tail % QUEUE_SIZE].id, p->queue[tail % QUEUE_SIZE].value);
+   }
+   atomic_store_explicit(&p->tail, tail, memory_order_release);
+}
+
+
+static uint32_t params_count(const clap_plugin_t *plugin) {
+   return NPARAMS;
+}
+
+
+static bool params_get_info(const clap_plugin_t *plugin, uint32_t index, clap_param_info_t *info) {
+   if (index >= NPARAMS) return false;
+   memset(info, 0, sizeof(*info));
+   info->id = index;
+   info->flags = CLAP_PARAM_IS_AUTOMATABLE;
+   if (index == PARAM_BYPASS) info->flags |= CLAP_PARAM_IS_STEPPED | CLAP_PARAM_IS_BYPASS;
+   snprintf(info->name, sizeof(info->name), "%s", params[index].name);
+   info->min_value = params[index].min;
+   info->max_value = params[index].max;
+   info->default_value = params[index].def;
+   return true;
+}
+
+
+static bool params_get_value(const clap_plugin_t *plugin, clap_id id, double *value) {
+   struct plugin *p = plugin->plugin_data;
+   if (id >= NPARAMS) return false;
+   *value = p->value[id];
+   return true;
+}
+
+
+static bool params_value_to_text(const clap_plugin_t *plugin, clap_id id, double value,
+   char *text, uint32_t size) {
+   if (id >= NPARAMS) return false;
+   if (id == PARAM_BYPASS) {
+      snprintf(text, size, "%s", value >= 0.5 ? "On" : "Off");
+   } else {
+      snprintf(text, size, "%.3f", value);
+   }
+   return true;
+}
+
+
+static bool params_text_to_value(const clap_plugin_t *plugin, clap_id id, const char *text,
+   double *value) {
+   if (id >= NPARAMS) return false;
+   if (id == PARAM_BYPASS) {
+      *value = !strcmp(text, "On") || !strcmp(text, "1");
+   } else {
+      *value = atof(text);
+   }
+   return true;
+}
+
+
+static void params_flush(const clap_plugin_t *plugin, const clap_input_events_t *in,
+   const clap_output_events_t *out) {
+   struct plugin *p = plugin->plugin_data;
+   queue_drain(p);
+   for (uint32_t i = 0; i < in->size(in); i++) {
+      param_events(p, in, i);
+   }
+}
+
+
+static const clap_plugin_params_t ext_params = {
+   params_count, params_get_info, params_get_value,
+   params_value_to_text, params_text_to_value, params_flush,
+};
+
+
+//=================================================================== STATE ===
+
+
+// The controls, as they are in memory. Nothing else survives a reload.
+//
+// A state is loaded on the main thread, and while the plugin is active the
+// audio thread may be running the tracker. So then the values are queued,
+// like the events of a block, and set by process or flush. The queue has
+// one writer on each side, so it needs no lock.
+
+static bool state_save(const clap_plugin_t *plugin, const clap_ostream_t *stream) {
+   struct plugin *p = plugin->plugin_data;
+   return stream->write(stream, p->value, sizeof(p->value)) == sizeof(p->value);
+}
+
+
+static bool state_load(const clap_plugin_t *plugin, const clap_istream_t *stream) {
+   struct plugin *p = plugin->plugin_data;
+   float value[NPARAMS];
+   if (stream->read(stream, value, sizeof(value)) != sizeof(value)) return false;
+   if (!p->active) {
+      for (clap_id id = 0; id < NPARAMS; id++) {
+         param_set(p, id, value[id]);
+      }
+      return true;
+   }
+   unsigned head = atomic_load_explicit(&p->head, memory_order_relaxed);
+   unsigned tail = atomic_load_explicit(&p->tail, memory_order_acquire);
+   if (head - tail + NPARAMS > QUEUE_SIZE) return false; // Not yet taken
+   for (clap_id id = 0; id < NPARAMS; id++) {
+      p->queue[(head + id) % QUEUE_SIZE].id = id;
+      p->queue[(head + id) % QUEUE_SIZE].value = value[id];
+   }
+   atomic_store_explicit(&p->head, head + NPARAMS, memory_order_release);
+   const clap_host_params_t *hp = p->host->get_extension ?
+      p->host->get_extension(p->host, CLAP_EXT_PARAMS) : NULL;
+   if (hp && hp->request_flush) hp->request_flush(p->host);
+   return true;
+}
+
+
+static const clap_plugin_state_t ext_state = {state_save, state_load};
+
+
+//=================================================================== AUDIO ===
+
+
+// Mono in like the guitar, and the same out on both channels like the
+// Hothouse.
+
+static uint32_t ports_count(const clap_plugin_t *plugin, bool is_input) {
+   return 1;
+}
+
+
+static bool ports_get(const clap_plugin_t *plugin, uint32_t index, bool is_input,
+   clap_audio_port_info_t *info) {
+   if (index != 0) return false;
+   memset(info, 0, sizeof(*info));
+   info->id = 0;
+   snprintf(info->name, sizeof(info->name), "%s", is_input ? "Guitar" : "Synth");
+   info->flags = CLAP_AUDIO_PORT_IS_MAIN;
+   info->channel_count = is_input ? 1 : 2;
+   info->port_type = is_input ? CLAP_PORT_MONO : CLAP_PORT_STEREO;
+   info->in_place_pair = CLAP_INVALID_ID;
+   return true;
+}
+
+
+static const clap_plugin_audio_ports_t ext_ports = {ports_count, ports_get};
+
+
+// At 88.2 kHz or more every tracker sample is the mean of factor host
+// samples, and every synth sample is held as long, a delay of factor host
+// samples. The mean is a crude low-pass, but the tracker's own filter is
+// far below it.
+#define DOWN_MAX 64
+
+static void render_down(struct plugin *p, const float *in, float *out, uint32_t n) {
+   while (n > 0) {
+      float down[DOWN_MAX], up[DOWN_MAX];
+      uint32_t fill = p->fill;
+      uint32_t m = 0;
+      uint32_t k = 0;
+      for (; k < n && m < DOWN_MAX; k++) {
+         p->sum += in[k];
+         if (++p->fill == p->factor) {
+            down[m++] = p->sum / p->factor;
+            p->sum = 0.0f;
+            p->fill = 0;
+         }
+      }
+      if (m) moly_process(down, up, m, NULL);
+      for (uint32_t i = 0, j = 0; i < k; i++) {
+         out[i] = p->held;
+         if (++fill == p->factor) {
+            p->held = up[j++];
+            fill = 0;
+         }
+      }
+      in += k;
+      out += k;
+      n -= k;
+   }
+}
+
+
+// The dry signal is mixed in here, at the host rate
+static void render(struct plugin *p, const float *in, float *out, uint32_t n) {
+   if (n == 0) return;
+   if (p->value[PARAM_BYPASS] >= 0.5f) {
+      memcpy(out, in, n * sizeof(float));
+      return;
+   }
+   moly_select(p->moly);
+   if (p->factor > 1) {
+      render_down(p, in, out, n);
+   } else {
+      moly_process(in, out, n, NULL);
+   }
+   float v = p->value[PARAM_DRYVOLUME];
+   if (!v) return;
+   for (uint32_t i = 0; i < n; i++) {
+      out[i] += v * in[i];
+   }
+}
+
+
+// The events are sorted by time, so the block is cut where the controls
+// change. moly_process keeps the analysis on its own grid wherever the
+// cuts are.
+static clap_process_status plugin_process(const clap_plugin_t *plugin,
+   const clap_process_t *process) {
+   struct plugin *p = plugin->plugin_data;
+   const float *in = process->audio_inputs[0].data32[0];
+   float *const *out = process->audio_outputs[0].data32;
+   const clap_input_events_t *ev = process->in_events;
+   uint32_t nev = ev->size(ev);
+   uint32_t at = 0;
+   queue_drain(p);
+   for (uint32_t i = 0; i < nev; i++) {
+      uint32_t time = ev->get(ev, i)->time;
+      if (time > process->frames_count) time = process->frames_count;
+      if (time > at) {
+         render(p, in + at, out[0] + at, time - at);
+         at = time;
+      }
+      param_events(p, ev, i);
+   }
+   render(p, in + at, out[0] + at, process->frames_count - at);
+   memcpy(out[1], out[0], process->frames_count * sizeof(float));
+   return CLAP_PROCESS_CONTINUE;
+}
+
+
+//================================================================== PLUGIN ===
+
+
+static const char *features[] = {
+   CLAP_PLUGIN_FEATURE_AUDIO_EFFECT, CLAP_PLUGIN_FEATURE_MONO, NULL
+};
+
+static const clap_plugin_descriptor_t descriptor = {
+   .clap_version = CLAP_VERSION_INIT,
+   .id = "com.github.aholtsberg.molysynth",
+   .name = "Molysynth",
+   .vendor = "Anders Holtsberg",
+   .url = "https://github.com/aholtsberg/Molysynth",
+   .manual_url = "",
+   .support_url = "",
+   .version = "0.1",
+   .description = "Monophonic guitar synth",
+   .features = features,
+};
+
+
+static bool plugin_init(const clap_plugin_t *plugin) {
+   return true;
+}
+
+
+static void plugin_destroy(const clap_plugin_t *plugin) {
+   struct plugin *p = plugin->plugin_data;
+   free(p->moly);
+   free(p);
+}
+
+
+// The whole state starts over, nothing is allocated
+// The analysis runs inline in process, so its worst case takes time from
+// one host block. make wcet finds about 26000 samples touched at most, so
+// this only cuts the rare analysis that would go far beyond.
+#define BUDGET 32768
+
+static bool start_over(struct plugin *p, uint32_t sample_rate) {
+   memset(p->moly, 0, moly_size());
+   p->fill = 0;
+   p->sum = 0.0f;
+   p->held = 0.0f;
+   moly_select(p->moly);
+   if (moly_init(sample_rate) != 0) return false;
+   moly_set(MOLY_BUDGET, BUDGET);
+   for (clap_id id = 0; id < NPARAMS; id++) {
+      param_set(p, id, p->value[id]);
+   }
+   return true;
+}
+
+
+// The tracker is made for 44.1 to 48 kHz, its filter and its wavelength
+// range. A multiple of that is taken down by the smallest factor that gets
+// there, eg 8 at 352.8 kHz, any other rate is refused.
+static bool plugin_activate(const clap_plugin_t *plugin, double sample_rate,
+   uint32_t min_frames, uint32_t max_frames) {
+   struct plugin *p = plugin->plugin_data;
+   uint32_t rate = (uint32_t)sample_rate;
+   uint32_t factor = 1;
+   while (rate % factor || rate / factor > 48000) factor++;
+   if (rate / factor < 44100) return false;
+   p->factor = factor;
+   p->sample_rate = rate / factor;
+   p->active = start_over(p, p->sample_rate);
+   return p->active;
+}
+
+
+static void plugin_deactivate(const clap_plugin_t *plugin) {
+   struct plugin *p = plugin->plugin_data;
+   queue_drain(p); // The audio thread is done
+   p->active = false;
+}
+
+
+static bool plugin_start_processing(const clap_plugin_t *plugin) {
+   return true;
+}
+
+
+static void plugin_stop_processing(const clap_plugin_t *plugin) {
+}
+
+
+static void plugin_reset(const clap_plugin_t *plugin) {
+   struct plugin *p = plugin->plugin_data;
+   start_over(p, p->sample_rate);
+}
+
+
+static const void *plugin_get_extension(const clap_plugin_t *plugin, const char *id) {
+   if (!strcmp(id, CLAP_EXT_PARAMS)) return &ext_params;
+   if (!strcmp(id, CLAP_EXT_STATE)) return &ext_state;
+   if (!strcmp(id, CLAP_EXT_AUDIO_PORTS)) return &ext_ports;
+   return NULL;
+}
+
+
+static void plugin_on_main_thread(const clap_plugin_t *plugin) {
+}
+
+
+//================================================================= FACTORY ===
+
+
+static uint32_t factory_count(const clap_plugin_factory_t *factory) {
+   return 1;
+}
+
+
+static const clap_plugin_descriptor_t *factory_descriptor(const clap_plugin_factory_t *factory,
+   uint32_t index) {
+   return index == 0 ? &descriptor : NULL;
+}
+
+
+static const clap_plugin_t *factory_create(const clap_plugin_factory_t *factory,
+   const clap_host_t *host, const char *plugin_id) {
+   if (!clap_version_is_compatible(host->clap_version) || strcmp(plugin_id, descriptor.id)) {
+      return NULL;
+   }
+   struct plugin *p = calloc(1, sizeof(struct plugin));
+   if (!p) return NULL;
+   p->moly = calloc(1, moly_size());
+   if (!p->moly) {
+      free(p);
+      return NULL;
+   }
+   p->host = host;
+   for (clap_id id = 0; id < NPARAMS; id++) {
+      p->value[id] = params[id].def;
+   }
+   p->plugin = (clap_plugin_t){
+      .desc = &descriptor,
+      .plugin_data = p,
+      .init = plugin_init,
+      .destroy = plugin_destroy,
+      .activate = plugin_activate,
+      .deactivate = plugin_deactivate,
+      .start_processing = plugin_start_processing,
+      .stop_processing = plugin_stop_processing,
+      .reset = plugin_reset,
+      .process = plugin_process,
+      .get_extension = plugin_get_extension,
+      .on_main_thread = plugin_on_main_thread,
+   };
+   return &p->plugin;
+}
+
+
+static const clap_plugin_factory_t factory = {
+   factory_count, factory_descriptor, factory_create
+};
+
+
+static bool entry_init(const char *path) {
+   return true;
+}
+
+
+static void entry_deinit(void) {
+}
+
+
+static const void *entry_get_factory(const char *id) {
+   return !strcmp(id, CLAP_PLUGIN_FACTORY_ID) ? &factory : NULL;
+}
+
+
+CLAP_EXPORT const clap_plugin_entry_t clap_entry = {
+   CLAP_VERSION_INIT, entry_init, entry_deinit, entry_get_factory
+};
@@ -6,6 +6,7 @@
 // option) any later version.
 
 
+#include <assert.h>
 #include <math.h>
 #include <string.h>
 #include "molysynth.h"
@@ -13,25 +14,107 @@
 #ifdef OFFLINE
 #include <stdio.h>
 #define P(...) if (g.settings.verbose) printf(__VA_ARGS__)
+#define STAT(stage, n) (moly_stats.stage += (n), g.work.done += (n))
+struct moly_stats moly_stats;
 #else
 #define P(...)
+#define STAT(stage, n) (g.work.done += (n))
 #endif
 
 
 //================================================================= GLOBALS ===
 
 
-#define LAMBDA_MIN 30
-#define LAMBDA_MAX 550
+#define LAMBDA_MIN MOLY_LAMBDA_MIN
+#define LAMBDA_MAX MOLY_LAMBDA_MAX
+#define ACF_CYCLES 16 // Longest autocorrelation window, in wavelengths
 #define MTYPE_NONE 0
 #define MTYPE_NEW 1
 #define MTYPE_TRIG 2
-#define RING_MASK ((1<<16) - 1)
-#define SILENCE_LEVEL (0.25 * g.settings.triglevel)
-#define ACFD2_MAX 0.5
+#define SILENCE_LEVEL (0.25f * g.settings.triglevel)
+#define ACFD2_MAX 0.5f
+#define ACFD2_TARGET 0.02f // Good enough to stop early, see window_length()
+
+// The ring holds the longest window plus what the audio writes while we
+// analyze, rounded up to a power of two. Indices are uint16_t.
+#define RING_SLACK 4096
+#define RING_SPAN ((ACF_CYCLES + 2) * LAMBDA_MAX + RING_SLACK)
+#define RING_BITS (RING_SPAN <= 4096 ? 12 : RING_SPAN <= 8192 ? 13 : \
+   RING_SPAN <= 16384 ? 14 : RING_SPAN <= 32768 ? 15 : 16)
+#define RING_SIZE (1 << RING_BITS)
+#define RING_MASK (RING_SIZE - 1)
+
+// The start of the ring is mirrored after its end, so anything that reads
+// one D2_STEP block and the same block one lag later reads straight ahead.
+// The longest lag is LAMBDA_MAX plus a delta, see t_lambda_acf.
+#define RING_MIRROR (LAMBDA_MAX + LAMBDA_MAX / 16 + D2_STEP + 2)
+typedef char ring_span_check[RING_SPAN <= 65536 ? 1 : -1];
+
+// Fixed block size, or whatever the caller gives us
+#define BLOCK(size) (MOLY_BLOCK_SIZE ? (size_t)MOLY_BLOCK_SIZE : (size))
+
+// The blocks of moly_process, there is always an analysis after a block
+#define PROCESS_BLOCK (MOLY_BLOCK_SIZE ? MOLY_BLOCK_SIZE : 48)
+typedef char process_block_check[MOLY_PERIOD % PROCESS_BLOCK == 0 ? 1 : -1];
+
+// The low-pass filter is designed at 44.1 kHz. For another sample rate the
+// poles are moved to keep the same response, r^2 = 0.82^(44100 / fs), and
+// the gain is normalized to one at DC. With MOLY_SAMPLE_RATE these are
+// constant expressions, computed by the compiler, so no double is left for
+// run time. Otherwise moly_init computes them, once, the same way. So is
+// the volume ramp of the synth, 1 ms.
+#define CEXP(x) (1.0 + (x) * (1.0 + (x) / 2 * (1.0 + (x) / 3 * \
+   (1.0 + (x) / 4 * (1.0 + (x) / 5 * (1.0 + (x) / 6))))))
+#define CCOS(x) (1.0 - (x) * (x) / 2 * (1.0 - (x) * (x) / 12 * \
+   (1.0 - (x) * (x) / 30)))
+#define LP_A1_AT(fs) ((float)((fs) == 44100 ? 1.8 : \
+   2.0 * CEXP(-0.0992254693619192 * 44100.0 / (fs)) * \
+   CCOS(0.1106572211738946 * 44100.0 / (fs))))
+#define LP_A2_AT(fs) ((float)((fs) == 44100 ? 0.82 : \
+   CEXP(-0.1984509387238383 * 44100.0 / (fs))))
+#define LP_GAIN_AT(fs) ((float)((fs) == 44100 ? 0.02 : \
+   1.0 - LP_A1_AT(fs) + LP_A2_AT(fs)))
+#if MOLY_SAMPLE_RATE
+#define LP_A1 LP_COEF(LP_A1_AT(MOLY_SAMPLE_RATE))
+#define LP_A2 LP_COEF(LP_A2_AT(MOLY_SAMPLE_RATE))
+#define LP_GAIN LP_COEF(LP_GAIN_AT(MOLY_SAMPLE_RATE))
+#define RAMP_LENGTH (MOLY_SAMPLE_RATE / 1000)
+#else
+#define LP_A1 (g.lp.a1)
+#define LP_A2 (g.lp.a2)
+#define LP_GAIN (g.lp.gain)
+#define RAMP_LENGTH (g.synth.ramp)
+#endif
+
+// With MOLY_FIXED the audio path is integer: the filter, the ring, the
+// indices, the zero crossings and the oscillator. The samples in the ring are
+// Q15 and saturate at +-32767, so that the absolute value fits too. So the
+// ring is the same on every machine. The analysis proper, once per message,
+// is single precision float, and is only the same with the same compiler
+// and libm, and with no fused multiply-add (-ffp-contract=off, make fixed).
+#if MOLY_FIXED
+typedef int16_t sample_t; // Q15
+typedef int32_t wide_t;   // A sample, or the difference of two
+typedef int32_t lpstate_t; // Q27, the filter output before saturation
+typedef uint32_t phase_t; // Q32 turns, wraps by itself
+#define SAMPLE_FLOAT(x) ((float)(x) * (1.0f / 32768))
+#define PHASE_STEP(lambda) ((phase_t)(4294967296.0f / (lambda)))
+#define Q30(x) ((int32_t)((x) * 1073741824.0 + 0.5))
+typedef int32_t lpcoef_t; // Q30
+#define LP_COEF(x) Q30(x)
+#else
+typedef float sample_t;
+typedef float wide_t;
+typedef float lpstate_t;
+typedef float phase_t;
+#define SAMPLE_FLOAT(x) (x)
+#define PHASE_STEP(lambda) (1.0f / (lambda))
+typedef float lpcoef_t;
+#define LP_COEF(x) (x)
+#endif
 
 // Various globals
-struct {
+struct globals {
 
    // Settings
    struct {
@@ -40,48 +123,102 @@ struct {
       float wetvolume;
       float triglevel;
       float complevel;
+      float resonance;
+      int attack;
+      int bass;
+      int glide;
+      int filterbank;
+      int budget;
+      float window;
+      float trigwindow;
       int verbose;
    } settings;
 
+   // Work of this analysis, counted by STAT, see budget_left()
+   struct {
+      int done;
+      int limit;
+   } work;
+
    // Synth
    struct {
       float lambda;
-      float phi;
+      phase_t phi;
       float vol;
       float vol_delta;
       int vol_count;
-      int vol_state;
+      int vol_state; // 0 once the last message was silence
+      int ramp; // See RAMP_LENGTH
    } synth;
 
+   // Low-pass filter coefficients, see LP_A1
+   struct {
+      lpcoef_t a1;
+      lpcoef_t a2;
+      lpcoef_t gain;
+   } lp;
+
+};
+
+
+#define ZSIZE 32
+#define D2_STEP 16 // Checkpoint distance in the difference index
+#define GLIDE_CROSSINGS 8
+
+// The tracker. One tracker follows one monophonic voice, that is one string
+// in hexaphonic mode or the whole guitar otherwise.
+struct tracker {
    // Low-pass filter
    struct {
-      float x1;
-      float x2;
+      lpstate_t x1;
+      lpstate_t x2;
    } filter;
 
-   // Message from tracker
-   struct moly_message message;
-
    // Ringbuffer
    struct {
-      float buf[(1<<16)];
-      uint16_t i; // Note: this can index the ringbuffer without MASK!
+      sample_t buf[RING_SIZE + RING_MIRROR]; // See RING_MIRROR
+      uint64_t e2[RING_SIZE / D2_STEP]; // The energy index, see energy()
+      uint64_t e2sum; // Up to i
+      uint16_t i; // Always masked with RING_MASK
       size_t time;
    } ring;
 
-} g;
+   // Message from tracker
+   struct moly_message message;
 
+   // Difference index, see d2index_track()
+   struct {
+      int lag[3];
+      uint16_t upto[3];
+      size_t time;
+      size_t start; // Of the first checkpoint, see d2index_cycles()
+      uint64_t c[3][RING_SIZE / D2_STEP];
+   } d2;
 
-#define ZSIZE 32
+   // Onset detector, see onset_detect
+   struct {
+      float env;
+      float lambda; // Last wavelength from the analysis
+      float trig_lambda;
+      float volume;
+      size_t time; // Of the last onset
+      bool pending; // For the synth
+   } onset;
+
+   // Pitch between the analyses, see glide_detect
+   struct {
+      float ref; // The last analysis, if locked
+      float lambda;
+      bool pending; // For the synth
+      float age[GLIDE_CROSSINGS]; // Of the last upward zero crossings
+   } glide;
 
-// The tracker
-struct {
-   // Ringbuffer
+   // Where the analysis is in the ringbuffer
    uint16_t i;
    uint16_t i_previous;
    size_t time;
    uint16_t xi;
-   float xv;
+   sample_t xv;
    struct zevent {
       uint16_t i; // zerocrossing index
       uint16_t xi; // extreme value index
@@ -93,6 +230,7 @@ struct {
    bool locked;
    float thismax;
    float prevmax;
+   float level; // RMS of the new samples, see t_update()
    float prevvolume;
    float prevlambda;
    int lambda_raw;
@@ -101,26 +239,397 @@ struct {
    float acf_m2;
    float acf_d2;
    int acf_len;
-} t;
+   float lambda_long; // Too long for this ring, see pyramid_analyze()
+   int octave; // Below the sample rate, 0 except in the pyramid
+   size_t trigtime; // Of the last trig, see window_length()
+   int quality; // MOLY_QUALITY_..., what the work budget allowed
+
+   // The note so far, see note_add()
+   struct {
+      bool on;
+      size_t start;
+      size_t peaktime;
+      float peak;
+      float n, sx, sy, sxx, sxy; // Level in dB against seconds after the peak
+      float d2sum;
+      int periodic;
+      float log2sum;
+      int pitched;
+      size_t last; // Of the last pitch
+      float center; // Slow mean of the pitch in cents
+      float dev2;
+      int sign; // Of the deviation from center
+      int crossings;
+      size_t first_crossing, last_crossing;
+   } note;
+};
+
+// For the bass, the levels below the mono tracker, see PYRAMID
+#define OCTAVES MOLY_OCTAVES
+#if OCTAVES
+struct pyramid {
+   struct tracker t[OCTAVES];
+   sample_t pair[OCTAVES]; // First of the pair for level k, from level k - 1
+};
+#endif
+
+// The filter bank, see FILTER BANK
+#define BANDS 8 // Fundamental and 7 harmonics
+
+struct bank {
+   float lambda;
+   float open; // 1.0 while there is a tone, else 0.0
+
+   // Per filter, ic1 and ic2 are the state, a1, a2 and a3 the coefficients
+   float ic1[BANDS];
+   float ic2[BANDS];
+   float a1[BANDS];
+   float a2[BANDS];
+   float a3[BANDS];
+   float gain[BANDS];
+};
+
+// One tracker per string, see HEXAPHONIC
+#if MOLY_HEX
+#define HEX_LANES ((MOLY_HEX + 7) & ~7) // Padded to a SIMD friendly width
+
+struct hex {
+   struct tracker t[MOLY_HEX];
+   struct moly_message message[MOLY_HEX];
+
+   // Low-pass filters
+   lpstate_t x1[HEX_LANES];
+   lpstate_t x2[HEX_LANES];
+
+   // Envelope since last analysis
+   sample_t peak[HEX_LANES];
+
+   // Synths
+   float lambda[HEX_LANES];
+   phase_t phi[HEX_LANES];
+   float vol[HEX_LANES];
+   float vol_delta[HEX_LANES];
+   int vol_count[HEX_LANES];
+   int vol_state[HEX_LANES];
+};
+#endif
+
+// All of the above, one instance. Normally there is only one, in static
+// memory. With MOLY_INSTANCES the host has as many as it likes, and self
+// is the one that moly_select chose for this thread. So is t, the tracker
+// we are analyzing right now, since analyses can run side by side.
+struct moly_state {
+   struct globals g;
+   struct tracker mono;
+#if OCTAVES
+   struct pyramid pyramid;
+#endif
+   struct bank bank;
+#if MOLY_HEX
+   struct hex hex;
+#endif
+};
+
+#if MOLY_INSTANCES
+#ifdef __cplusplus
+#define THREAD_LOCAL thread_local
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+static THREAD_LOCAL struct moly_state *self;
+static THREAD_LOCAL struct tracker *t;
+#else
+static struct moly_state single_state;
+#define self (&single_state)
+static struct tracker *t = &single_state.mono;
+#endif
+
+#define g (self->g)
+#define mono (self->mono)
+#define pyramid (self->pyramid)
+#define bank (self->bank)
+#define hex (self->hex)
+
+
+// The work budget, MOLY_BUDGET, in samples touched the same way as
+// moly_stats. A budget of 0 is no limit.
+static inline void budget_start(int limit) {
+   g.work.done = 0;
+   g.work.limit = g.settings.budget ? limit : 1 << 30;
+}
+
+
+static inline int budget_left(void) {
+   return g.work.limit - g.work.done;
+}
+
+
+// Milliseconds in samples of a tracker, that runs at a lower rate in the
+// pyramid.
+static inline int ms_samples(float ms, int octave) {
+   return (int)(ms * 0.001f * g.settings.sample_frequency) >> octave;
+}
+
+
+
+
+//========================================================= COMPRESS VOLUME ===
+
+
+static inline float compress_volume(float volume) {
+   if (volume > g.settings.complevel) return volume;
+   if (volume > 0.2f * g.settings.complevel) return g.settings.complevel;
+   return 5.0f * volume;
+}
+
+
+//================================================================== ONSET ===
+
+
+// A fast trig in the audio path, for the attack. The analysis sees a new
+// note up to an analysis period late, here we see it within the block. The
+// block peak is compared with a peak envelope that holds over the longest
+// wavelength, with the same 4/3 rule as the analysis, ie a rise in the one
+// band we have. The synth starts the note at once with the last wavelength
+// the analysis found, and the analysis corrects it when it runs.
+
+#define ONSET_DECAY (1.0f - 0.1f / LAMBDA_MAX) // Per sample
+#define ONSET_HOLD (4 * LAMBDA_MAX) // No second trig for the same attack
+#define ONSET_TINY 1e-20f // Less is silence
+
+// Wavelength from the last two upward zero crossings, when we know nothing
+static float onset_lambda(void) {
+   uint16_t i = mono.ring.i;
+   int last = 0;
+   for (int k = 1; k < 2 * LAMBDA_MAX; k++) {
+      sample_t x0 = mono.ring.buf[(i - k - 1) & RING_MASK];
+      sample_t x1 = mono.ring.buf[(i - k) & RING_MASK];
+      if (x0 < 0 && x1 >= 0) {
+         if (last && k - last >= LAMBDA_MIN) return k - last;
+         last = k;
+      }
+   }
+   return 0.0f;
+}
+
+
+static void onset_detect(uint16_t from, size_t size) {
+   float env = mono.onset.env;
+   float peak = 0.0f;
+   for (size_t k = 0; k < size; k++) {
+      float x = SAMPLE_FLOAT(mono.ring.buf[(from + k) & RING_MASK]);
+      float a = x < 0.0f ? -x : x;
+      peak = a > peak ? a : peak;
+      env *= ONSET_DECAY;
+      env = a > env ? a : env;
+   }
+   if (env < ONSET_TINY) env = 0.0f; // Else it sticks at a denormal in silence
+   if (peak > g.settings.triglevel && 3.0f * peak > 4.0f * mono.onset.env &&
+      mono.ring.time > mono.onset.time + ONSET_HOLD) {
+      float lambda = mono.onset.lambda;
+      if (lambda == 0.0f) lambda = onset_lambda();
+      if (lambda != 0.0f) {
+         mono.onset.trig_lambda = lambda;
+         mono.onset.volume = compress_volume(peak);
+         mono.onset.pending = true;
+         mono.onset.time = mono.ring.time;
+      }
+   }
+   mono.onset.env = env;
+}
+
+
+//================================================================== GLIDE ===
+
+
+// Between the analyses the pitch is stepwise, which shows in vibrato and
+// bends. Here in the audio path the time between upward zero crossings one
+// wavelength apart gives the wavelength right now. Crossings from harmonics
+// are not one wavelength apart, so the wavelength of the last analysis gates
+// them, and only when it was locked. The synth takes the new wavelength at
+// the next block, a continuation without a message.
+
+#define GLIDE_GATE 16 // Within 1/16 of the analysis, about a halftone
+#define GLIDE_STALE (8.0f * LAMBDA_MAX) // Older crossings all look the same
+
+static void glide_detect(uint16_t from, size_t size) {
+   float ref = mono.glide.ref;
+   float *age = mono.glide.age;
+   for (int j = 0; j < GLIDE_CROSSINGS; j++) {
+      age[j] = age[j] + size < GLIDE_STALE ? age[j] + size : GLIDE_STALE;
+   }
+   if (ref == 0.0f) return;
+   float lambda = 0.0f;
+   sample_t x1 = mono.ring.buf[(from - 1) & RING_MASK];
+   for (size_t k = 0; k < size; k++) {
+      sample_t x0 = x1;
+      x1 = mono.ring.buf[(from + k) & RING_MASK];
+      if (x0 >= 0 || x1 < 0) continue;
+
+      // Between sample k - 1 and k, counted back from the end of the block
+      float a = SAMPLE_FLOAT(x0);
+      float now = (size - k) - a / (a - SAMPLE_FLOAT(x1));
+      for (int j = 0; j < GLIDE_CROSSINGS; j++) {
+         float d = age[j] - now;
+         if (d > ref + ref / GLIDE_GATE) break;
+         if (d > ref - ref / GLIDE_GATE) {
+            lambda = d;
+            break;
+         }
+      }
+      for (int j = GLIDE_CROSSINGS - 1; j > 0; j--) {
+         age[j] = age[j - 1];
+      }
+      age[0] = now;
+   }
+   if (lambda != 0.0f) {
+      mono.glide.lambda = lambda;
+      mono.glide.pending = true;
+   }
+}
 
 
 //============================================================= RING BUFFER ===
 
 
-inline static float lpfilter(float x) {
-   float y = x + 1.8 * g.filter.x1 - 0.82 * g.filter.x2;
-   g.filter.x2 = g.filter.x1;
-   g.filter.x1 = y;
-   return 0.02 * y;
+#if MOLY_FIXED
+
+// Rounded and saturated, the input can be anything
+static inline int32_t q15(float x) {
+   x *= 32768.0f;
+   if (x >= 32767.0f) return 32767;
+   if (x <= -32767.0f) return -32767;
+   return (int32_t)(x < 0.0f ? x - 0.5f : x + 0.5f);
+}
+
+
+// The state is the output in Q27, with room for the resonance, and the
+// coefficients are Q30. The sums are 64 bits wide, so only the rounding
+// of y is inexact and it is the same on every machine.
+inline static sample_t lpfilter(float in, lpstate_t *x1, lpstate_t *x2) {
+   int64_t acc = (int64_t)LP_GAIN * q15(in) * 4096 +
+      (int64_t)LP_A1 * *x1 - (int64_t)LP_A2 * *x2;
+   int32_t y = (int32_t)((acc + (1 << 29)) >> 30);
+   *x2 = *x1;
+   *x1 = y;
+   y = (y + 2048) >> 12;
+   return y > 32767 ? 32767 : y < -32767 ? -32767 : y;
+}
+
+#define LP_TINY 2048 // Rounds to a zero sample
+
+#else
+
+inline static sample_t lpfilter(float x, lpstate_t *x1, lpstate_t *x2) {
+   float y = x + LP_A1 * *x1 - LP_A2 * *x2;
+   *x2 = *x1;
+   *x1 = y;
+   return LP_GAIN * y;
+}
+
+#define LP_TINY 1e-20f
+
+#endif
+
+// In digital silence the state decays into denormals, or a rounding limit
+// cycle, and never reaches zero. So it is set to zero there, the state of
+// a fresh start, see moly_seek.
+inline static void lpsnap(float in, lpstate_t *x1, lpstate_t *x2) {
+   if (in == 0.0f && *x1 < LP_TINY && *x1 > -LP_TINY &&
+         *x2 < LP_TINY && *x2 > -LP_TINY) {
+      *x1 = *x2 = 0;
+   }
+}
+
+
+// Next to the ringbuffer we keep the running sum of squared samples. It is
+// fixed point so it can not drift, it just wraps around. Like the difference
+// index it is only kept every D2_STEP samples, and the samples since then
+// are added when it is read. So the energy of any window is one subtraction
+// and two short sums, at half a byte per sample.
+#define E2_SCALE 4294967296.0f // 2^32
+
+#if MOLY_FIXED
+// A difference of two samples is below 2^16, so its square fits 32 bits
+static inline uint64_t e2_quantize(wide_t x) {
+   uint32_t a = x < 0 ? -x : x;
+   return (uint64_t)(a * a) << 2;
+}
+#else
+static inline uint64_t e2_quantize(wide_t x) {
+   return (uint64_t)(x * x * E2_SCALE);
+}
+#endif
+
+
+// The running sum before ring index i
+static inline uint64_t e2_before(uint16_t i) {
+   i &= RING_MASK;
+   uint16_t i0 = i & ~(D2_STEP - 1);
+   uint64_t e = t->ring.e2[i0 / D2_STEP];
+   for (uint16_t k = i0; k != i; k++) e += e2_quantize(t->ring.buf[k]);
+   return e;
+}
+
+
+// Energy of the n samples before ring index i
+static inline float energy(uint16_t i, int n) {
+   uint64_t e = e2_before(i) - e2_before(i - n);
+   return (float)e * (1.0f / E2_SCALE);
 }
 
 
+#if OCTAVES
+// Sample x at time of the level below level k. Every pair of samples is
+// averaged and filtered again with the same filter, which at half the rate
+// has half the cutoff. So a level is the one below, an octave down.
+static void pyramid_push(int k, sample_t x, size_t time) {
+   if (!(time & 1)) {
+      pyramid.pair[k] = x;
+      return;
+   }
+   struct tracker *tr = &pyramid.t[k];
+   float in = SAMPLE_FLOAT((pyramid.pair[k] + x) / 2);
+   sample_t y = lpfilter(in, &tr->filter.x1, &tr->filter.x2);
+   lpsnap(in, &tr->filter.x1, &tr->filter.x2);
+   uint16_t i = tr->ring.i;
+   tr->ring.buf[i] = y;
+   if (i < RING_MIRROR) tr->ring.buf[RING_SIZE + i] = y;
+   tr->ring.e2sum += e2_quantize(y);
+   tr->ring.i = (i + 1) & RING_MASK;
+   if (!(tr->ring.i % D2_STEP)) tr->ring.e2[tr->ring.i / D2_STEP] = tr->ring.e2sum;
+   if (k + 1 < OCTAVES) pyramid_push(k + 1, y, tr->ring.time);
+   tr->ring.time++;
+}
+#endif
+
+
 // Exported! Filtering is necessary to bring down the number of zero crossings.
+// Note that we are in the audio interrupt here, so we do not touch t.
 void moly_addtobuf(const float *in, size_t size) {
+   size = BLOCK(size);
+   uint64_t e2 = mono.ring.e2sum;
    for (size_t i = 0; i < size; i++) {
-      g.ring.buf[g.ring.i++] = lpfilter(in[i]); // uint16_t for ringbuffer :-)
+      sample_t x = lpfilter(in[i], &mono.filter.x1, &mono.filter.x2);
+      mono.ring.buf[mono.ring.i] = x;
+      if (mono.ring.i < RING_MIRROR) mono.ring.buf[RING_SIZE + mono.ring.i] = x;
+      e2 += e2_quantize(x);
+      mono.ring.i = (mono.ring.i + 1) & RING_MASK;
+      if (!(mono.ring.i % D2_STEP)) mono.ring.e2[mono.ring.i / D2_STEP] = e2;
    }
-   g.ring.time += size;
+   mono.ring.e2sum = e2;
+   mono.ring.time += size;
+   if (size) lpsnap(in[size - 1], &mono.filter.x1, &mono.filter.x2);
+   if (g.settings.attack) onset_detect((mono.ring.i - size) & RING_MASK, size);
+   if (g.settings.glide) glide_detect((mono.ring.i - size) & RING_MASK, size);
+#if OCTAVES
+   if (g.settings.bass) {
+      uint16_t from = (mono.ring.i - size) & RING_MASK;
+      for (size_t k = 0; k < size; k++) {
+         pyramid_push(0, mono.ring.buf[(from + k) & RING_MASK], mono.ring.time - size + k);
+      }
+   }
+#endif
 }
 
 
@@ -131,9 +640,9 @@ void moly_addtobuf(const float *in, size_t size) {
 // noise. Therefore we change it slowly.
 static inline void synth_volume_set(int type, float volume) {
    if (type == MTYPE_TRIG) {
-      g.synth.vol = 0.0;
+      g.synth.vol = 0.0f;
    }
-   g.synth.vol_count = 1 * 48; // 1 ms in the future
+   g.synth.vol_count = RAMP_LENGTH; // 1 ms in the future
    g.synth.vol_delta = (g.settings.wetvolume * volume - g.synth.vol) / g.synth.vol_count;
 }
 
@@ -148,49 +657,103 @@ static inline float synth_volume_next(void) {
 }
 
 
+#if MOLY_FIXED
+// The square wave of synthesizer in Q15, one step from phi0 to phi. A wrap
+// is the jump up, and the jumps are interpolated the same way.
+static inline int32_t square_q15(uint32_t phi0, uint32_t phi, uint32_t step) {
+   if (phi < phi0) {
+      return (int32_t)(((int64_t)phi + phi0 - 4294967296) * 32768 / step);
+   } else if (phi < 0x80000000u) {
+      return 32768;
+   } else if (phi0 < 0x80000000u) {
+      return (int32_t)(((int64_t)0x80000000u - phi0 - (phi - 0x80000000u)) * 32768 / step);
+   }
+   return -32768;
+}
+#endif
+
+
 static inline void synthesizer(float *out, size_t size) {
    
-   // Read message
-   if (g.message.type != MTYPE_NONE) {
-      if (g.message.volume != 0.0 && g.message.lambda != 0.0) {
-         g.synth.lambda = g.message.lambda;
+   // Onset, a trig before the analysis
+   if (mono.onset.pending) {
+      g.synth.lambda = mono.onset.trig_lambda;
+      synth_volume_set(MTYPE_TRIG, mono.onset.volume);
+      g.synth.vol_state = 1;
+      mono.onset.pending = false;
+   }
+
+   // Read message. If the onset detector has trigged already, the trig
+   // of the analysis for the same attack only goes on with the note.
+   if (mono.message.type != MTYPE_NONE) {
+      int type = mono.message.type;
+      size_t onset = mono.onset.time;
+      if (type == MTYPE_TRIG && onset &&
+         onset + ONSET_HOLD > mono.time && mono.time + ONSET_HOLD > onset) {
+         type = MTYPE_NEW;
       }
-      synth_volume_set(g.message.type, g.message.volume);
-      g.message.type = MTYPE_NONE;
+      if (mono.message.volume != 0.0f && mono.message.lambda != 0.0f) {
+         g.synth.lambda = mono.message.lambda;
+      }
+      synth_volume_set(type, mono.message.volume);
+      g.synth.vol_state = mono.message.volume != 0.0f;
+      mono.message.type = MTYPE_NONE;
+   }
+
+   // Pitch since the message
+   if (mono.glide.pending) {
+      if (g.synth.vol_state) g.synth.lambda = mono.glide.lambda;
+      mono.glide.pending = false;
+   }
+
+   // Faded out after silence. The next tone starts from scratch, so what
+   // comes after a pause does not depend on what came before it.
+   if (!g.synth.vol_state && g.synth.vol_count < 0) {
+      g.synth.lambda = 0.0f;
+      g.synth.vol_delta = 0.0f;
    }
 
    // Silence
-   if (g.synth.lambda == 0.0) {
+   if (g.synth.lambda == 0.0f) {
       for (size_t i = 0; i < size; i++) {
          out[i] = 0;
       }
-      g.synth.phi = 0.0;
-      g.synth.vol = 0.0;
+      g.synth.phi = 0;
+      g.synth.vol = 0.0f;
       return;
    }
 
    // Run
-   float phidelta = 1.0 / g.synth.lambda;
+   phase_t phidelta = PHASE_STEP(g.synth.lambda);
+#if MOLY_FIXED
+   for (size_t i = 0; i < size; i++) {
+      phase_t phi = g.synth.phi + phidelta;
+      float x = (float)square_q15(g.synth.phi, phi, phidelta) * (1.0f / 32768);
+      out[i] = synth_volume_next() * x;
+      g.synth.phi = phi;
+   }
+#else
    for (size_t i = 0; i < size; i++) {
        float phi = g.synth.phi + phidelta;
-       float x = 1.0;
+       float x = 1.0f;
        // This hoopla is because we have to interpolate when the square wave
        // jumps. This is likely well known to you folks out there but I
        // discovered it the hard way. If this is not done, then it sounds
        // really bad. 
-       if (phi < 0.5) {
+       if (phi < 0.5f) {
           // do nothing
-       } else if (phi >= 1.0) {
-          x = x * ((phi - 1.0) - (1.0 - g.synth.phi)) / phidelta;
-          phi -= 1.0;
-       } else if (g.synth.phi < 0.5) {
-          x = x * ((0.5 - g.synth.phi) - (phi - 0.5)) / phidelta;
+       } else if (phi >= 1.0f) {
+          x = x * ((phi - 1.0f) - (1.0f - g.synth.phi)) / phidelta;
+          phi -= 1.0f;
+       } else if (g.synth.phi < 0.5f) {
+          x = x * ((0.5f - g.synth.phi) - (phi - 0.5f)) / phidelta;
        } else {
           x = -x;
        }
        out[i] = synth_volume_next() * x;
        g.synth.phi = phi;
    }
+#endif
 }
 
 
@@ -203,132 +766,378 @@ static void add_dry(const float *in, float *out, size_t size) {
 }
 
 
+//============================================================= FILTER BANK ===
+
+
+// The effect instead of the synth. Band-pass filters on the fundamental and
+// its harmonics, one lane per filter so that the bank runs in SIMD. These
+// are state variable filters in the trapezoidal form, which stay stable
+// while the coefficients move. The coefficients are computed once per block
+// and glide there linearly, sample by sample, else the bank zippers when the
+// pitch moves. The filters follow the level of the input by themselves, so
+// the volume in the message only opens and closes them.
+
+static void filterbank(const float *in, float *out, size_t size) {
+
+   // Read message
+   if (mono.message.type != MTYPE_NONE) {
+      if (mono.message.volume != 0.0f && mono.message.lambda != 0.0f) {
+         bank.lambda = mono.message.lambda;
+      }
+      bank.open = mono.message.volume != 0.0f;
+      mono.message.type = MTYPE_NONE;
+   }
+   if (mono.glide.pending) {
+      if (bank.open != 0.0f) bank.lambda = mono.glide.lambda;
+      mono.glide.pending = false;
+   }
+
+   // Targets for the end of this block
+   float d1[BANDS];
+   float d2[BANDS];
+   float d3[BANDS];
+   float dgain[BANDS];
+   float k = 1.0f / g.settings.resonance;
+   for (int h = 0; h < BANDS; h++) {
+      float a1 = bank.a1[h];
+      float a2 = bank.a2[h];
+      float a3 = bank.a3[h];
+      float gain = 0.0f;
+      float f = bank.lambda != 0.0f ? (h + 1) / bank.lambda : 0.0f; // Cycles per sample
+      if (f > 0.0f && f < 0.45f) {
+         float w = tanf((float)M_PI * f);
+         a1 = 1.0f / (1.0f + w * (w + k));
+         a2 = w * a1;
+         a3 = w * a2;
+         gain = bank.open * g.settings.wetvolume * k / (h + 1);
+      }
+      if (bank.a1[h] == 0.0f) { // First time, no glide
+         bank.a1[h] = a1;
+         bank.a2[h] = a2;
+         bank.a3[h] = a3;
+      }
+      d1[h] = (a1 - bank.a1[h]) / size;
+      d2[h] = (a2 - bank.a2[h]) / size;
+      d3[h] = (a3 - bank.a3[h]) / size;
+      dgain[h] = (gain - bank.gain[h]) / size;
+   }
+
+   // Run
+   for (size_t i = 0; i < size; i++) {
+      float sum = 0.0f;
+      for (int h = 0; h < BANDS; h++) {
+         bank.a1[h] += d1[h];
+         bank.a2[h] += d2[h];
+         bank.a3[h] += d3[h];
+         bank.gain[h] += dgain[h];
+         float v3 = in[i] - bank.ic2[h];
+         float v1 = bank.a1[h] * bank.ic1[h] + bank.a2[h] * v3;
+         float v2 = bank.ic2[h] + bank.a2[h] * bank.ic1[h] + bank.a3[h] * v3;
+         bank.ic1[h] = 2.0f * v1 - bank.ic1[h];
+         bank.ic2[h] = 2.0f * v2 - bank.ic2[h];
+         sum += bank.gain[h] * v1;
+      }
+      out[i] = sum;
+   }
+
+   // Closed, so the gains are down to 0 now. The next tone starts from
+   // scratch, as in the synth.
+   if (bank.open == 0.0f) memset(&bank, 0, sizeof(bank));
+}
+
+
 //==================================================== ZERO CROSSING EVENTS ===
 
 
 static void zevent_add(int i, int xi, float xv) {
    for (int k = ZSIZE - 1; k > 0; k--) {
-      t.z[k] = t.z[k - 1];
+      t->z[k] = t->z[k - 1];
    }
-   t.z[0].i = i;
-   t.z[0].xi = xi;
-   t.z[0].xv = xv;
+   t->z[0].i = i;
+   t->z[0].xi = xi;
+   t->z[0].xv = xv;
 }
 
 
 static void zevents_wipeout(void) {
    for (int k = 0; k < ZSIZE; k++) {
-      t.z[k].i = 0;
-      t.z[k].xi = 0;
-      t.z[k].xv = 0.0;
+      t->z[k].i = 0;
+      t->z[k].xi = 0;
+      t->z[k].xv = 0.0f;
    }
 }
 
 
-//========================================================= COMPRESS VOLUME ===
+//=================================================================== NOTES ===
 
 
-static inline float compress_volume(float volume) {
-   if (volume > g.settings.complevel) return volume;
-   if (volume > 0.2 * g.settings.complevel) return g.settings.complevel;
-   return 5.0 * volume;
+// What a note was like, from its TRIG to silence or the next TRIG. It is
+// added up from what the analysis has anyway, once per analysis, and ends
+// up in the message that ends the note, see NOTE 7 in molysynth.h. The
+// pitch only counts where the autocorrelation is as good as when the
+// tracker locks. The vibrato is the deviation from a slow mean of the
+// pitch, which follows a bend but not a vibrato of some Hz.
+
+#define VIBRATO_TAU 0.15f // Seconds, of the slow mean
+#define VIBRATO_MIN 3.0f  // Cents, a deviation less than this is no crossing
+
+static void note_end(void) {
+   struct moly_note *m = &t->message.note;
+   float fs = g.settings.sample_frequency / (float)(1 << t->octave);
+   m->start = t->note.start;
+   m->length = t->time - t->note.start;
+   m->attack = t->note.peaktime - t->note.start;
+   m->peak = t->note.peak;
+   float det = t->note.n * t->note.sxx - t->note.sx * t->note.sx;
+   if (det > 0.0f) {
+      m->decay = (t->note.n * t->note.sxy - t->note.sx * t->note.sy) / det;
+   }
+   if (t->note.pitched) {
+      m->lambda = exp2f(t->note.log2sum / t->note.pitched);
+      m->vibrato = sqrtf(2.0f * t->note.dev2 / t->note.pitched);
+   }
+   if (t->note.crossings > 1) {
+      size_t span = t->note.last_crossing - t->note.first_crossing;
+      m->vibrato_rate = 0.5f * (t->note.crossings - 1) * fs / span;
+   }
+   if (t->note.periodic) {
+      m->periodicity = 1.0f - 0.5f * t->note.d2sum / t->note.periodic;
+   }
+   memset(&t->note, 0, sizeof(t->note));
+}
+
+
+static void note_add(float lambda, float volume, float d2, bool trig) {
+   memset(&t->message.note, 0, sizeof(t->message.note));
+   if (t->note.on && (trig || volume == 0.0f)) note_end();
+   if (volume == 0.0f || !(trig || t->note.on)) return;
+   if (!t->note.on) {
+      t->note.on = true;
+      t->note.start = t->time;
+   }
+   float fs = g.settings.sample_frequency / (float)(1 << t->octave);
+
+   // The level, and how it falls after the peak
+   if (volume > t->note.peak) {
+      t->note.peak = volume;
+      t->note.peaktime = t->time;
+      t->note.n = t->note.sx = t->note.sy = t->note.sxx = t->note.sxy = 0.0f;
+   }
+   float x = (t->time - t->note.peaktime) / fs;
+   float y = 20.0f * log10f(volume);
+   t->note.n += 1.0f;
+   t->note.sx += x;
+   t->note.sy += y;
+   t->note.sxx += x * x;
+   t->note.sxy += x * y;
+
+   // Periodicity, where there is an autocorrelation
+   if (d2 < ACFD2_MAX) {
+      t->note.d2sum += d2;
+      t->note.periodic++;
+   }
+
+   // Pitch and vibrato
+   if (d2 < 0.1f && lambda != 0.0f) {
+      float cents = 1200.0f * log2f(lambda);
+      if (t->note.pitched == 0) {
+         t->note.center = cents;
+         t->note.last = t->time;
+      }
+      float dt = (t->time - t->note.last) / fs;
+      t->note.center += (cents - t->note.center) * dt / (dt + VIBRATO_TAU);
+      float dev = cents - t->note.center;
+      int sign = dev > VIBRATO_MIN ? 1 : dev < -VIBRATO_MIN ? -1 : 0;
+      if (sign != 0 && sign != t->note.sign) {
+         if (t->note.sign != 0) {
+            if (t->note.crossings == 0) t->note.first_crossing = t->time;
+            t->note.last_crossing = t->time;
+            t->note.crossings++;
+         }
+         t->note.sign = sign;
+      }
+      t->note.dev2 += dev * dev;
+      t->note.log2sum += log2f(lambda);
+      t->note.pitched++;
+      t->note.last = t->time;
+   }
 }
 
 
 //=========================================================== PITCH TRACKER ===
 
 
-static void set_message(float lambda, float volume) {
+static void set_message(float lambda, float volume, float d2) {
 
    // Problem?
-   if (lambda == 0.0 && volume > 0.0) {
-      if (t.prevvolume > 0.0) {
-         lambda = t.prevlambda;
+   if (lambda == 0.0f && volume > 0.0f) {
+      if (t->prevvolume > 0.0f) {
+         lambda = t->prevlambda;
       } else {
-         volume = 0.0;
+         volume = 0.0f;
       }
    }
 
    // Side effects for silence and trigger
    int mtype = MTYPE_NEW;
-   if (volume == 0.0) {
+   if (volume == 0.0f) {
       zevents_wipeout();
-      t.lambda_raw = 0;
-      t.lambda_acf = 0.0;
-      t.trig = false;
-      t.locked = false;
-   } else if (t.trig) {
+      t->lambda_raw = 0;
+      t->lambda_acf = 0.0f;
+      t->trig = false;
+      t->locked = false;
+   } else if (t->trig) {
       mtype = MTYPE_TRIG;
-      t.trig = false;
+      t->trig = false;
+      t->trigtime = t->time;
    }
+   note_add(lambda, volume, d2, mtype == MTYPE_TRIG);
+   if (lambda != 0.0f) t->onset.lambda = lambda;
+   t->glide.ref = t->locked && volume != 0.0f ? lambda : 0.0f;
 
    // Remember these
-   t.prevvolume = volume;
-   t.prevlambda = lambda;
+   t->prevvolume = volume;
+   t->prevlambda = lambda;
 
    // Write new message
-   g.message.lambda = lambda;
-   g.message.volume = compress_volume(volume);
-   g.message.type = mtype; // <-- Message is atomic. This is written last!
-   P("%3.1f %5.3f ", g.message.lambda, g.message.volume);
+   t->message.lambda = lambda;
+   t->message.volume = compress_volume(volume);
+   t->message.quality = t->quality;
+   t->message.type = mtype; // <-- Message is atomic. This is written last!
+   P("%3.1f %5.3f ", t->message.lambda, t->message.volume);
    if (mtype == MTYPE_TRIG) {
        P("T ");
    }
+   if (t->quality) {
+       P("Q%d ", t->quality);
+   }
 }
 
 
 static void t_update(void) {
 
-   // We note that g.ring.i can change under our feet so we copy it first.
-   t.i_previous = t.i;
-   t.i = g.ring.i;
-   t.time = g.ring.time; // Only for debug, no need for semaphore
-
-   // Find new zero crossings.
-   float themin = 0.0;
-   float themax = 0.0;
-   float x0;
-   float x1 = g.ring.buf[t.i_previous - 1];
-   for (uint16_t i = t.i_previous; i != t.i; i++) {
-      x0 = x1;
-      x1 = g.ring.buf[i];
-      if (x0 >= 0.0) {
-         if (x1 < 0.0) {
-            zevent_add(i, t.xi, t.xv);
-            t.xv = x1; t.xi = i; // Start min
-         }
-         else if (x1 > t.xv) {
-            t.xv = x1; t.xi = i; // Update max 
-         }
-      }
-      else {
-         if (x1 >= 0) {
-            zevent_add(i, t.xi, t.xv);
-            t.xv = x1; t.xi = i; // Start max
+   // We note that t->ring.i can change under our feet so we copy it first.
+   t->i_previous = t->i;
+   t->i = t->ring.i;
+   t->time = t->ring.time; // Only for debug, no need for semaphore
+   STAT(update, (t->i - t->i_previous) & RING_MASK);
+
+   // Find new zero crossings. The new samples are read straight ahead, in
+   // two pieces only if they wrap around further than the mirror.
+   sample_t themin = 0;
+   sample_t themax = 0;
+   sample_t x0;
+   sample_t x1 = t->ring.buf[(t->i_previous - 1) & RING_MASK];
+   uint16_t from = t->i_previous;
+   int left = (t->i - t->i_previous) & RING_MASK;
+   while (left > 0) {
+      const sample_t *x = &t->ring.buf[from];
+      int n = RING_SIZE + RING_MIRROR - from;
+      if (n > left) n = left;
+      for (int k = 0; k < n; k++) {
+         x0 = x1;
+         x1 = x[k];
+         uint16_t i = (from + k) & RING_MASK;
+         if (x0 >= 0) {
+            if (x1 < 0) {
+               zevent_add(i, t->xi, SAMPLE_FLOAT(t->xv));
+               t->xv = x1; t->xi = i; // Start min
+            }
+            else if (x1 > t->xv) {
+               t->xv = x1; t->xi = i; // Update max 
+            }
          }
-         else if (x1 < t.xv) { // Update min
-            t.xv = x1; t.xi = i;
+         else {
+            if (x1 >= 0) {
+               zevent_add(i, t->xi, SAMPLE_FLOAT(t->xv));
+               t->xv = x1; t->xi = i; // Start max
+            }
+            else if (x1 < t->xv) { // Update min
+               t->xv = x1; t->xi = i;
+            }
          }
+         if (x1 > themax) themax = x1;
+         if (x1 < themin) themin = x1;
       }
-      if (x1 > themax) themax = x1;
-      if (x1 < themin) themin = x1;
+      from = (from + n) & RING_MASK;
+      left -= n;
    }
-   // t.thismax = (themax - themin) / 2.0; // Not really as good :-(
-    t.thismax = themax > -themin? themax: -themin;
+   // t->thismax = (themax - themin) / 2.0; // Not really as good :-(
+    t->thismax = SAMPLE_FLOAT(themax > -themin? themax: -themin);
    //float tmp = themax > -themin? themax: -themin;
-   //t.thismax = 0.75 * t.thismax + 0.25 * tmp;
+   //t->thismax = 0.75 * t->thismax + 0.25 * tmp;
+
+   // The peak is good for trig but it jumps around, so volume and silence
+   // use the RMS of at least the longest wavelength, scaled to a sine peak.
+   int n = (t->i - t->i_previous) & RING_MASK;
+   if (n < LAMBDA_MAX) n = LAMBDA_MAX;
+   t->level = sqrtf(2.0f * energy(t->i, n) / n);
 
    // We compute trig already here so the analysis can use it
-   if ((t.prevlambda == 0.0 && t.thismax > g.settings.triglevel) ||
-      (3 * t.thismax > 4 * t.prevmax)) {
-      t.trig = true;
+   if ((t->prevlambda == 0.0f && t->thismax > g.settings.triglevel) ||
+      (3 * t->thismax > 4 * t->prevmax)) {
+      t->trig = true;
    }
-   t.prevmax = t.thismax;
+   t->prevmax = t->thismax;
+}
+
+
+// Silence that stays silence. If the tracker is silent and no new sample
+// reaches the trig level, the analysis says silence whatever the zero
+// crossings are, and they are wiped out. So only what survives is updated,
+// the same way as t_update: the peak and the extreme value since the last
+// crossing. Returns false, having done nothing, otherwise.
+static bool t_update_quiet(void) {
+   uint16_t i = t->ring.i;
+   uint16_t from = t->i;
+   int n = (i - from) & RING_MASK;
+   if (t->prevlambda != 0.0f || n == 0) return false;
+   const sample_t *x = t->ring.buf;
+   sample_t peak = 0;
+   for (int k = 0; k < n; k++) {
+      sample_t a = x[(from + k) & RING_MASK];
+      a = a < 0 ? -a : a;
+      peak = a > peak ? a : peak;
+   }
+   if (!(SAMPLE_FLOAT(peak) < g.settings.triglevel)) return false;
+
+   // Back to the last crossing, and from there the extreme value
+   int k = n - 1;
+   while (k >= 0 && (x[(from + k - 1) & RING_MASK] < 0) == (x[(from + k) & RING_MASK] < 0)) k--;
+   if (k >= 0) {
+      t->xi = (from + k) & RING_MASK;
+      t->xv = x[t->xi];
+      k++;
+   } else {
+      k = 0;
+   }
+   bool below = x[(from + k - 1) & RING_MASK] < 0;
+   for (; k < n; k++) {
+      sample_t v = x[(from + k) & RING_MASK];
+      if (below ? v < t->xv : v > t->xv) {
+         t->xv = v;
+         t->xi = (from + k) & RING_MASK;
+      }
+   }
+   // Digital silence, the extreme value starts over as for a silent string
+   if (peak == 0) {
+      t->xi = i;
+      t->xv = 0;
+   }
+
+   t->i_previous = from;
+   t->i = i;
+   t->time = t->ring.time;
+   STAT(update, n);
+   t->thismax = t->prevmax = SAMPLE_FLOAT(peak);
+   if (n < LAMBDA_MAX) n = LAMBDA_MAX;
+   t->level = sqrtf(2.0f * energy(t->i, n) / n);
+   return true;
 }
 
 
 static bool peakisfeasable(int i, float limit) {
-   float x = t.z[i].xv;
+   float x = t->z[i].xv;
    if (limit < 0) limit = -limit;
    if (x > limit) return true;
    if (x < -limit) return true;
@@ -368,12 +1177,13 @@ static bool bumpfitsmuchbetter(int i, int j, int k) {
    uint16_t ui, uj, uk;
    float di, dj, dk, tmp;
    float mj, mk;
-   if (k > 16 || t.z[k + 1].xv == 0.0) return false;    
+   if (k > 16 || t->z[k + 1].xv == 0.0f) return false;    
+   STAT(raw, 3);
 
    // Mismatch distance left to peak
-   ui = t.z[i].xi - t.z[i + 1].i + 1;
-   uj = t.z[j].xi - t.z[j + 1].i + 1;
-   uk = t.z[k].xi - t.z[k + 1].i + 1;
+   ui = (t->z[i].xi - t->z[i + 1].i + 1) & RING_MASK;
+   uj = (t->z[j].xi - t->z[j + 1].i + 1) & RING_MASK;
+   uk = (t->z[k].xi - t->z[k + 1].i + 1) & RING_MASK;
    dj = (float)(int16_t)(uj - ui);
    dk = (float)(int16_t)(uk - ui);
    dj = dj * dj;
@@ -383,9 +1193,9 @@ static bool bumpfitsmuchbetter(int i, int j, int k) {
    mk = dk / di;
 
    // Mismatch distance peak to right
-   ui = t.z[i].i - t.z[i].xi + 1;
-   uj = t.z[j].i - t.z[j].xi + 1;
-   uk = t.z[k].i - t.z[k].xi + 1;
+   ui = (t->z[i].i - t->z[i].xi + 1) & RING_MASK;
+   uj = (t->z[j].i - t->z[j].xi + 1) & RING_MASK;
+   uk = (t->z[k].i - t->z[k].xi + 1) & RING_MASK;
    dj = (float)(int16_t)(uj - ui);
    dk = (float)(int16_t)(uk - ui);
    dj = dj * dj;
@@ -400,9 +1210,9 @@ static bool bumpfitsmuchbetter(int i, int j, int k) {
    if (tmp < mk) mk = tmp;
 
    // Mismatch peak height
-   di = t.z[i].xv;
-   dj = t.z[j].xv; 
-   dk = t.z[k].xv;
+   di = t->z[i].xv;
+   dj = t->z[j].xv; 
+   dk = t->z[k].xv;
    dj = dj - di;
    dj = dj * dj;
    dk = dk - di;
@@ -412,7 +1222,7 @@ static bool bumpfitsmuchbetter(int i, int j, int k) {
    mk += dk / di;
 
    //P("\nX %d %d %d %0.5f %0.5f\n", i, j, k, mj, mk);
-   if (mj > 0.01 && 16.0 * mk < mj) { // mj is squared, so it is 1/10 and 1/4
+   if (mj > 0.01f && 16.0f * mk < mj) { // mj is squared, so it is 1/10 and 1/4
       return true;
    }
    return false;
@@ -423,7 +1233,7 @@ static int pick_lambda_raw(int lm0, int lm1) {
    lm0 = checklambda(lm0);
    lm1 = checklambda(lm1);
    int lambda = 0;
-   int prevlambda = (int)t.prevlambda;
+   int prevlambda = (int)t->prevlambda;
 
    // Find a good lambda
    if (lm0 == 0) {
@@ -446,13 +1256,13 @@ static int pick_lambda_raw(int lm0, int lm1) {
 
    // Now we come to part two. What if both sides have gone an octave up to
    // the first overtone? We simply override it.
-   if (t.locked && lambdas_are_close(2 * lambda, prevlambda)) {
+   if (t->locked && lambdas_are_close(2 * lambda, prevlambda)) {
       lambda = lambda * 2;
    }
 
    // Also, it happens that bumpfitsmuchbetter because there is another tone
    // interferring and resulting in octave down. We correct it. 
-   if (t.locked && lambdas_are_close(lambda, 2 * prevlambda)) {
+   if (t->locked && lambdas_are_close(lambda, 2 * prevlambda)) {
       lambda = prevlambda;
    }
    return lambda;
@@ -462,11 +1272,12 @@ static int pick_lambda_raw(int lm0, int lm1) {
 static void t_lambda_raw_oneside(int i_start, int lambda[3]) {
    int j[2];
    int k = 0;
-   float limit = t.thismax / 2;
+   float limit = t->thismax / 2;
    // Note: every second peak is on the same side, therefore += 2
    for (int i = i_start; i < ZSIZE - 1; i += 2) {
+      STAT(raw, 1);
       if (peakisfeasable(i, limit)) {
-         int lim = 3.0 * t.z[i].xv / 4.0;
+         int lim = 3.0f * t->z[i].xv / 4.0f;
          if (k == 1 && !peakisfeasable(j[0], lim)) {
             j[0] = i;
             limit = lim;
@@ -485,17 +1296,17 @@ static void t_lambda_raw_oneside(int i_start, int lambda[3]) {
          }
          j[k++] = i;
          if (k == 2) break;
-         limit = 3.0 * t.z[i].xv / 4.0;
+         limit = 3.0f * t->z[i].xv / 4.0f;
          if (limit < 0) limit = -limit;
       }
    }
    if (k == 2) {
       // Beware: an earlier zevent is stored in higher index
-      if (t.z[j[1] + 1].xv != 0.0) {
-         lambda[0] = (t.z[j[0] + 1].i - t.z[j[1] + 1].i) & RING_MASK; // crossing 1
+      if (t->z[j[1] + 1].xv != 0.0f) {
+         lambda[0] = (t->z[j[0] + 1].i - t->z[j[1] + 1].i) & RING_MASK; // crossing 1
       }
-      lambda[1] = (t.z[j[0]].xi - t.z[j[1]].xi) & RING_MASK; // extreme value
-      lambda[2] = (t.z[j[0]].i - t.z[j[1]].i) & RING_MASK; // crossing 2
+      lambda[1] = (t->z[j[0]].xi - t->z[j[1]].xi) & RING_MASK; // extreme value
+      lambda[2] = (t->z[j[0]].i - t->z[j[1]].i) & RING_MASK; // crossing 2
    }
 }
 
@@ -509,43 +1320,141 @@ static void t_lambda_raw(void) {
    lambda[0][0], lambda[0][1], lambda[0][2],
    lambda[1][0], lambda[1][1], lambda[1][2]);
 
-   t.lambda_raw = pick_lambda_raw(median3(lambda[0]), median3(lambda[1]));
-   P(" %3d  ", t.lambda_raw);
+   t->lambda_raw = pick_lambda_raw(median3(lambda[0]), median3(lambda[1]));
+   P(" %3d  ", t->lambda_raw);
+}
+
+
+//======================================================== DIFFERENCE INDEX ===
+
+
+// The squared differences at the three lags around the wavelength are summed
+// the same way as the energy index, but only every D2_STEP samples. Between
+// analyses only the new samples are added, so a sustained note costs the
+// same no matter how long the windows are.
+
+
+static void d2index_extend(int j) {
+   int lag = t->d2.lag[j];
+   uint16_t end = (t->i - lag) & RING_MASK;
+   uint16_t k = t->d2.upto[j];
+   while (((end - k) & RING_MASK) >= D2_STEP) {
+      uint64_t c = t->d2.c[j][k / D2_STEP];
+      const sample_t *x = &t->ring.buf[k]; // Thanks to the mirror
+      STAT(index, D2_STEP);
+      for (int i = 0; i < D2_STEP; i++) {
+         c += e2_quantize(x[i] - x[i + lag]);
+      }
+      k = (k + D2_STEP) & RING_MASK;
+      t->d2.c[j][k / D2_STEP] = c;
+   }
+   t->d2.upto[j] = k;
+}
+
+
+// Returns the middle lag to use. If we already track lags close enough to
+// lM we keep them and only add the new samples, otherwise we start over,
+// as many cycles back as the work budget allows. Returns 0 if it does not
+// allow two cycles, or not even the new samples.
+static int d2index_track(int lM, int delta) {
+   int tracked = t->d2.lag[1];
+   int dist = lM > tracked ? lM - tracked : tracked - lM;
+   if (tracked == 0 || t->time - t->d2.time > RING_SLACK ||
+      2 * dist > tracked - t->d2.lag[0]) {
+      int cycles = budget_left() / (3 * (lM + delta));
+      if (cycles < 2) return 0;
+      if (cycles > ACF_CYCLES) cycles = ACF_CYCLES;
+      int window = ms_samples(g.settings.window, t->octave);
+      if (window && window / lM + 2 < cycles) cycles = window / lM + 2;
+      t->d2.lag[0] = lM - delta;
+      t->d2.lag[1] = lM;
+      t->d2.lag[2] = lM + delta;
+      uint16_t from = (t->i - cycles * (lM + delta)) & RING_MASK;
+      from &= ~(D2_STEP - 1);
+      t->d2.start = t->time - ((t->i - from) & RING_MASK);
+      for (int j = 0; j < 3; j++) {
+         t->d2.upto[j] = from;
+         t->d2.c[j][from / D2_STEP] = 0;
+      }
+   } else if (budget_left() < 3 * ((t->i - t->d2.upto[1]) & RING_MASK)) {
+      return 0;
+   }
+   for (int j = 0; j < 3; j++) {
+      d2index_extend(j);
+   }
+   t->d2.time = t->time;
+   return t->d2.lag[1];
+}
+
+
+// Whole cycles of lambda that the index reaches back from t->i. That is
+// ACF_CYCLES unless the budget cut it short when it started over.
+static int d2index_cycles(int lambda) {
+   size_t span = t->time - t->d2.start;
+   if (span >= (size_t)(ACF_CYCLES * lambda)) return ACF_CYCLES;
+   return (int)span / lambda;
+}
+
+
+// Sum of squared differences at lag number j for k in [a, b). The ends
+// that are not on a checkpoint are added in the same fixed point, so the
+// sum is exact and can not go negative.
+static float d2sum(int j, uint16_t a, uint16_t b) {
+   int lag = t->d2.lag[j];
+   uint16_t a0 = a & ~(D2_STEP - 1);
+   uint16_t b0 = b & ~(D2_STEP - 1);
+   uint64_t c = t->d2.c[j][b0 / D2_STEP] - t->d2.c[j][a0 / D2_STEP];
+   STAT(acf, 1 + (b - b0) + (a - a0));
+   const sample_t *x = t->ring.buf; // x[k + lag] is in the mirror
+   for (uint16_t k = b0; k != b; k++) c += e2_quantize(x[k] - x[k + lag]);
+   for (uint16_t k = a0; k != a; k++) c -= e2_quantize(x[k] - x[k + lag]);
+   return (float)c * (1.0f / E2_SCALE);
 }
 
 
 //========================================================= AUTOCORRELATION ===
 
 
+// The longest autocorrelation window in samples, from MOLY_WINDOW, or
+// MOLY_TRIGWINDOW until that long after a trig. Older history only slows
+// down the reaction to a new pitch. Zero if there is no limit, and then the
+// window is as long as the cycles keep matching, up to ACF_CYCLES.
+static int window_length(void) {
+   int w = ms_samples(g.settings.window, t->octave);
+   int wt = ms_samples(g.settings.trigwindow, t->octave);
+   if (wt && (t->trig || t->time - t->trigtime < (size_t)wt)) w = wt;
+   return w;
+}
+
+
+
 // Instead of maximizing ACF we minimize normalized sum squared diff.
-// That is the same thing.
-static float meandiff2mid(int lambda) {
-   uint16_t k = t.i - lambda; // For ringbuffer
-   float d2first = 0.0;
-   float m2first = 0.0;
+// That is the same thing. The lag is the middle one of the difference index.
+static float meandiff2mid(void) {
+   int lambda = t->d2.lag[1];
+   uint16_t k = (t->i - lambda) & RING_MASK; // For ringbuffer
+   float d2first = 0.0f;
+   float m2first = 0.0f;
 
    // Initialize m2 with the last cycle
-   float d2 = 0.0;
-   float m2 = 0.0;
-   for (uint16_t i = 0; i < lambda; i++) {
-      float x = g.ring.buf[(uint16_t)(k + i)];
-      m2 += x * x;
-   }
-
-   // Go backwards one cycle at a time
+   float d2 = 0.0f;
+   float m2 = energy(t->i, lambda);
+
+   // Go backwards one cycle at a time. With a window limit we also stop as
+   // soon as the cycles so far match well enough.
+   int window = window_length();
+   int maxcycles = window ? window / lambda : ACF_CYCLES;
+   if (maxcycles > ACF_CYCLES) maxcycles = ACF_CYCLES;
+   if (maxcycles < 2) maxcycles = 2;
+   int indexed = d2index_cycles(lambda);
+   bool cut = indexed < maxcycles; // By the work budget
+   if (cut) maxcycles = indexed;
    int ncycles = 2;
    for (;; ncycles++) {
       // Do next cycle
-      float d2t = 0.0;
-      float m2t = 0.0;
-      for (int i = 0; i < lambda; i++) {
-         --k;
-         float x0 = g.ring.buf[k];
-         float x1 = g.ring.buf[(uint16_t)(k + lambda)];
-         float d = x0 - x1;
-         d2t += d * d;
-         m2t += x1 * x1;
-      }
+      float d2t = d2sum(1, (k - lambda) & RING_MASK, k);
+      float m2t = energy(k + lambda, lambda);
+      k = (k - lambda) & RING_MASK;
       // Now, remember the first cycle's value
       if (ncycles == 2) {
          d2 = d2first = d2t;
@@ -556,7 +1465,7 @@ static float meandiff2mid(int lambda) {
          // to more than 30 percent of first cycle energy) AND cycle energy
          // does not shrink below half of first cycle energy THEN we add this
          // cycle and grab more.
-         if ((d2t < 3 * d2first || d2t < 0.3 * m2first) && 2 * m2t > m2first) {
+         if ((d2t < 3 * d2first || d2t < 0.3f * m2first) && 2 * m2t > m2first) {
             d2 += d2t;
             m2 += m2t;
          } else {
@@ -564,129 +1473,299 @@ static float meandiff2mid(int lambda) {
             break;
          }
       }
-      if (ncycles == 16) break;
+      if (ncycles >= maxcycles) {
+         if (cut) t->quality = MOLY_QUALITY_SHORT;
+         break;
+      }
+      if (window && d2 * ncycles < ACFD2_TARGET * (ncycles - 1) * m2) {
+         break;
+      }
    }
 
    d2 = d2 / (float) ((ncycles - 1) * lambda);
    int n = ncycles * lambda;
    m2 = m2 / (float) n;
-   if (m2 == 0.0) m2 = 1.0; // No div by 0 on next line
+   if (m2 == 0.0f) m2 = 1.0f; // No div by 0 on next line
    d2 = d2 / m2;
-   t.volume = sqrt(m2); // TODO: remove volume
-   t.acf_m2 = m2;
-   t.acf_d2 = d2;
-   t.acf_len = n;
-   P("%2d %.3f %0.3f ", ncycles, t.volume, d2);
+   t->volume = sqrtf(m2); // TODO: remove volume
+   t->acf_m2 = m2;
+   t->acf_d2 = d2;
+   t->acf_len = n;
+   P("%2d %.3f %0.3f ", ncycles, t->volume, d2);
    return d2;
 }
 
 
 // The window size and m2 are already precomputed
-static float meandiff2(int lambda) {
-   int n = t.acf_len;
-   float d2 = 0.0;
-   uint16_t i_stop = t.i - lambda;
-   for (uint16_t i = t.i - n; i != i_stop; i++) {
-      float x0 = g.ring.buf[i];
-      float x1 = g.ring.buf[(uint16_t)(i + lambda)];
-      float d = x0 - x1;
-      d2 += d * d;
-   }
-   return d2 / (t.acf_m2 * (float)(n - lambda));
+static float meandiff2(int j) {
+   int n = t->acf_len;
+   int lambda = t->d2.lag[j];
+   float d2 = d2sum(j, (t->i - n) & RING_MASK, (t->i - lambda) & RING_MASK);
+   return d2 / (t->acf_m2 * (float)(n - lambda));
 }
 
 
 static float t_lambda_acf(int lM) {
    float dL, dM, dR, b, c;
    int lL, lR, delta;
-   float lHat = 0.0;
-   if (lM == 0) {
+   float lHat = 0.0f;
+   if (lM == 0 || lM > LAMBDA_MAX + LAMBDA_MAX / 32) { // See RING_MIRROR
       goto bail;
    }
    delta = lM / 50; // Halftone approximately
    if (delta < 2) delta = 2;
-   lL = lM - delta;
-   lR = lM + delta;
-   dM = meandiff2mid(lM);
-   if (t.acf_d2 > ACFD2_MAX) {
+   lM = d2index_track(lM, delta);
+   if (lM == 0) {
+      t->quality = MOLY_QUALITY_RAW;
       goto bail;
    }
-   dL = meandiff2(lL);
-   dR = meandiff2(lR);
+   lL = t->d2.lag[0];
+   lR = t->d2.lag[2];
+   delta = lM - lL;
+   dM = meandiff2mid();
+   if (t->acf_d2 > ACFD2_MAX) {
+      goto bail;
+   }
+   dL = meandiff2(0);
+   dR = meandiff2(2);
    b = dR - dL;
-   c = dR - 2.0 * dM + dL;
-   if (c <= 0.0) {
+   c = dR - 2.0f * dM + dL;
+   if (c <= 0.0f) {
       goto bail;
    }
-   lHat = lM - (float)delta * (b / (2.0 * c));
-   if (lHat < lL || lR < lHat) lHat = 0.0;
+   lHat = lM - (float)delta * (b / (2.0f * c));
+   if (lHat < lL || lR < lHat) lHat = 0.0f;
+
+   bail:
+   if (lHat == 0.0f) t->acf_d2 = ACFD2_MAX;
+   return lHat;
+}
+
+
+//================================================================ ANALYSIS ===
+
+
+// Analyze whatever tracker t points at
+static void analyze(void) {
+   float d2;
+   if (!t_update_quiet()) t_update();
+   P("%zu %.3f  ", t->time, t->thismax);
+
+   // Silence?
+   if (t->level < SILENCE_LEVEL || 
+      (t->prevlambda == 0.0f && t->thismax < g.settings.triglevel)) {
+      set_message(0.0f, 0.0f, ACFD2_MAX);
+      goto bail;
+   }
+
+   // Not silence!
+   t->lambda_acf = 0.0f;
+   d2 = ACFD2_MAX;
+   if (t->prevlambda != 0.0f) {
+      //t->lambda_acf = t_lambda_acf(t->lambda_raw);
+      if (t->lambda_acf != 0.0f) d2 = t->acf_d2;
+   }
+   if (t->lambda_long != 0.0f) { // Only locked ones, see pyramid_analyze
+      t->lambda_acf = t->lambda_long;
+      d2 = 0.0f;
+   }
+   // Step down when the work budget runs out. The zero crossings alone,
+   // or else the previous wavelength, see set_message.
+   if ((t->lambda_acf == 0.0f || d2 > 0.1f) && budget_left() <= 0) {
+      t->quality = MOLY_QUALITY_HOLD;
+   } else if (t->lambda_acf == 0.0f || d2 > 0.1f) {
+      t_lambda_raw();
+      float tmp = t_lambda_acf(t->lambda_raw);
+      if (t->acf_d2 < d2) {
+         t->lambda_acf = tmp;
+         d2 = t->acf_d2;
+      } else if (t->quality == MOLY_QUALITY_RAW) {
+         t->lambda_acf = (float)t->lambda_raw;
+      }
+   }
+   if (d2 < 0.1f) t->locked = true;
+   set_message(t->lambda_acf, t->level, d2);
 
    bail:
-   if (lHat == 0.0) t.acf_d2 = ACFD2_MAX;
+   P("\n");
+}
+
+
+//================================================================= PYRAMID ===
+
+
+// Wavelengths longer than LAMBDA_MAX, for the bass. Every level of the
+// pyramid is a tracker of its own, with the same LAMBDA_MIN to LAMBDA_MAX in
+// its own samples, so level k covers LAMBDA_MAX << (k + 1). Each level has
+// half the samples of the one below, so all of them together cost about as
+// much as the mono tracker once more, not twice per octave. The mono tracker
+// takes a wavelength from the coarsest level that has one too long for the
+// level below it.
+
+#if OCTAVES
+
+// The level's wavelength on the full rate ring. A parabola through the sum
+// of squared differences over the last cycle, at lags one level sample apart.
+static float pyramid_refine(float lambda, int delta) {
+   int l = (int)(lambda + 0.5f);
+   uint16_t i = mono.ring.i;
+   uint64_t d[3] = {0};
+   if (budget_left() < 3 * l) {
+      mono.quality = MOLY_QUALITY_RAW;
+      return lambda;
+   }
+   STAT(acf, 3 * l);
+   for (int j = 0; j < 3; j++) {
+      int lag = l + (j - 1) * delta;
+      for (int k = 1; k <= l; k++) {
+         d[j] += e2_quantize(mono.ring.buf[(i - k) & RING_MASK] -
+            mono.ring.buf[(i - k - lag) & RING_MASK]);
+      }
+   }
+   float dL = (float)d[0];
+   float dM = (float)d[1];
+   float dR = (float)d[2];
+   float c = dR - 2.0f * dM + dL;
+   if (c <= 0.0f) return lambda;
+   float lHat = l - (float)delta * ((dR - dL) / (2.0f * c));
+   if (lHat < l - delta || l + delta < lHat) return lambda;
    return lHat;
 }
 
 
+static float pyramid_analyze(void) {
+   for (int k = 0; k < OCTAVES; k++) {
+      t = &pyramid.t[k];
+      t->quality = MOLY_QUALITY_FULL;
+      P("%dx ", 2 << k);
+      analyze();
+   }
+   t = &mono;
+   for (int k = OCTAVES - 1; k >= 0; k--) {
+      struct tracker *tr = &pyramid.t[k];
+      float lambda = tr->lambda_acf * (2 << k);
+      if (tr->lambda_acf != 0.0f && tr->acf_d2 < 0.1f && lambda > LAMBDA_MAX << k) {
+         return pyramid_refine(lambda, 2 << k);
+      }
+   }
+   return 0.0f;
+}
+
+#endif
+
+
+
 
 //================================================================ EXPORTED ===
 
 
 int moly_init(uint32_t sampleFrequency) {
+   if (MOLY_SAMPLE_RATE && sampleFrequency != MOLY_SAMPLE_RATE) return -1;
    g.settings.sample_frequency = sampleFrequency;
-   g.settings.dryvolume = 0.0;
-   g.settings.wetvolume = 0.5;
-   g.settings.triglevel = 0.08;
-   g.settings.complevel = 0.0;
+   g.settings.dryvolume = 0.0f;
+   g.settings.wetvolume = 0.5f;
+   g.settings.triglevel = 0.08f;
+   g.settings.complevel = 0.0f;
+   g.settings.resonance = 10.0f;
+   g.settings.attack = 0;
+   g.settings.bass = 0;
+   g.settings.glide = 0;
+   g.settings.filterbank = 0;
+   g.settings.budget = 0;
+   g.settings.window = 0.0f;
+   g.settings.trigwindow = 0.0f;
    g.settings.verbose = 0;
+   g.synth.vol_count = -1; // No ramp going on
+#if !MOLY_SAMPLE_RATE
+   g.synth.ramp = sampleFrequency / 1000;
+   g.lp.a1 = LP_COEF(LP_A1_AT(sampleFrequency));
+   g.lp.a2 = LP_COEF(LP_A2_AT(sampleFrequency));
+   g.lp.gain = LP_COEF(LP_GAIN_AT(sampleFrequency));
+#endif
+#if OCTAVES
+   for (int k = 0; k < OCTAVES; k++) {
+      pyramid.t[k].octave = k + 1;
+   }
+#endif
    return 0;
 }
 
 
 void moly_synth(const float *in, float *out, size_t size) {
-   if (g.settings.sample_frequency == 0.0) return;
+   size = BLOCK(size);
+   if (g.settings.sample_frequency == 0.0f) return;
    synthesizer(out, size);
    add_dry(in, out, size);
 }
 
 
+void moly_filter(const float *in, float *out, size_t size) {
+   size = BLOCK(size);
+   if (g.settings.sample_frequency == 0.0f) return;
+   filterbank(in, out, size);
+   add_dry(in, out, size);
+}
+
+
+#if MOLY_INSTANCES
+size_t moly_size(void) {
+   return sizeof(struct moly_state);
+}
+
+
+void moly_select(void *instance) {
+   self = instance;
+}
+#endif
+
+
 void moly_synth_message(struct moly_message *m) {
    // Do nothing. The synth knows where the message resides :-).
 }
 
 
 struct moly_message* moly_analyze(void) {
-   float d2;
-   t_update();
-   P("%zu %.3f  ", t.time, t.thismax);
+#ifdef OFFLINE
+   memset(&moly_stats, 0, sizeof(moly_stats));
+#endif
+   budget_start(g.settings.budget);
+   mono.quality = MOLY_QUALITY_FULL;
+#if OCTAVES
+   mono.lambda_long = g.settings.bass ? pyramid_analyze() : 0.0f;
+#endif
+   t = &mono;
+   analyze();
+   return &mono.message;
+}
 
-   // Silence?
-   if (t.thismax < SILENCE_LEVEL || 
-      (t.prevlambda == 0.0 && t.thismax < g.settings.triglevel)) {
-      set_message(0.0, 0.0);
-      goto bail;
-   }
 
-   // Not silence!
-   t.lambda_acf = 0.0;
-   d2 = ACFD2_MAX;
-   if (t.prevlambda != 0.0) {
-      //t.lambda_acf = t_lambda_acf(t.lambda_raw);
-      if (t.lambda_acf != 0.0) d2 = t.acf_d2;
-   }
-   if (t.lambda_acf == 0.0 || d2 > 0.1) {
-      t_lambda_raw();
-      float tmp = t_lambda_acf(t.lambda_raw);
-      if (t.acf_d2 < d2) {
-         t.lambda_acf = tmp;
-         d2 = t.acf_d2;
+size_t moly_process(const float *in, float *out, size_t nframes,
+   struct moly_message *messages) {
+   assert(nframes % BLOCK(1) == 0); // A fixed block size takes whole blocks
+   size_t count = 0;
+   while (nframes > 0) {
+      size_t time = mono.ring.time;
+      size_t size = PROCESS_BLOCK - time % PROCESS_BLOCK;
+      if (size > nframes) size = nframes;
+      moly_addtobuf(in, size);
+      if (out && g.settings.filterbank) {
+         moly_filter(in, out, size);
+      } else if (out) {
+         moly_synth(in, out, size);
+      } else { // No synth takes the onset and the glide
+         mono.onset.pending = false;
+         mono.glide.pending = false;
       }
+      if ((time + size) % MOLY_PERIOD == 0) {
+         struct moly_message *m = moly_analyze();
+         if (messages) messages[count] = *m;
+         count++;
+      }
+      in += size;
+      out = out ? out + size : NULL;
+      nframes -= size;
    }
-   if (d2 < 0.1) t.locked = true;
-   set_message(t.lambda_acf, t.thismax);
-
-   bail:
-   P("\n");
-   return &g.message;
+   return count;
 }
 
 
@@ -695,6 +1774,357 @@ void moly_set(char opt, float val) {
    if (opt == 'w') g.settings.wetvolume = val;
    if (opt == 't') g.settings.triglevel = val;
    if (opt == 'c') g.settings.complevel = val;
+   if (opt == 'q' && val > 0.5f) g.settings.resonance = val;
+   if (opt == 'a') g.settings.attack = val != 0.0f;
+   if (opt == 'b') g.settings.bass = OCTAVES && val != 0.0f;
+   if (opt == 'g') g.settings.glide = val != 0.0f;
+   if (opt == 'f') g.settings.filterbank = val != 0.0f;
+   if (opt == 'k') g.settings.budget = val > 0.0f ? (int)val : 0;
+   if (opt == 'l') g.settings.window = val > 0.0f ? val : 0.0f;
+   if (opt == 'i') g.settings.trigwindow = val > 0.0f ? val : 0.0f;
    if (opt == 'v') g.settings.verbose = (int)val;
 }
 
+
+
+//============================================================== HEXAPHONIC ===
+
+
+// One tracker per string. Everything that runs per sample, ie the filter,
+// the envelope and the synth, is kept as structure of arrays with one lane
+// per string. That way the compiler can run the strings side by side in SIMD
+// lanes. The analysis itself is per string and is the mono tracker code.
+// Only with MOLY_HEX, a mono build has none of it.
+
+#if MOLY_HEX
+
+void moly_hex_addtobuf(const float *const in[MOLY_HEX], size_t size) {
+   size = BLOCK(size);
+   uint16_t k = hex.t[0].ring.i; // All strings move in lockstep
+   uint64_t e2[HEX_LANES] = {0};
+   for (int s = 0; s < MOLY_HEX; s++) {
+      e2[s] = hex.t[s].ring.e2sum;
+   }
+   for (size_t i = 0; i < size; i++) {
+      float x[HEX_LANES] = {0};
+      sample_t y[HEX_LANES];
+      for (int s = 0; s < MOLY_HEX; s++) {
+         x[s] = in[s][i];
+      }
+      // One filter per lane
+      for (int s = 0; s < HEX_LANES; s++) {
+         y[s] = lpfilter(x[s], &hex.x1[s], &hex.x2[s]);
+         sample_t a = y[s] < 0 ? -y[s] : y[s];
+         hex.peak[s] = a > hex.peak[s] ? a : hex.peak[s];
+         e2[s] += e2_quantize(y[s]);
+      }
+      for (int s = 0; s < MOLY_HEX; s++) {
+         hex.t[s].ring.buf[k] = y[s];
+         if (k < RING_MIRROR) hex.t[s].ring.buf[RING_SIZE + k] = y[s];
+      }
+      k = (k + 1) & RING_MASK;
+      for (int s = 0; s < MOLY_HEX && !(k % D2_STEP); s++) {
+         hex.t[s].ring.e2[k / D2_STEP] = e2[s];
+      }
+   }
+   for (int s = 0; s < MOLY_HEX; s++) {
+      if (size) lpsnap(in[s][size - 1], &hex.x1[s], &hex.x2[s]);
+      hex.t[s].ring.e2sum = e2[s];
+      hex.t[s].ring.i = k;
+      hex.t[s].ring.time += size;
+   }
+}
+
+
+struct moly_message *moly_hex_analyze(void) {
+#ifdef OFFLINE
+   memset(&moly_stats, 0, sizeof(moly_stats));
+#endif
+   budget_start(0);
+   for (int s = 0; s < MOLY_HEX; s++) {
+      float peak = SAMPLE_FLOAT(hex.peak[s]);
+      hex.peak[s] = 0;
+      t = &hex.t[s];
+      t->quality = MOLY_QUALITY_FULL;
+
+      // The budget is shared, what one string leaves is for the next
+      g.work.limit += g.settings.budget / MOLY_HEX;
+      P("%d ", s);
+
+      // A string that stays silent costs nothing but its envelope. Since
+      // the silence wipes out the zero crossings anyway we need not look
+      // for them, and the extreme value starts over here.
+      if (t->prevlambda == 0.0f && peak < g.settings.triglevel) {
+         t->i_previous = t->i;
+         t->i = t->ring.i;
+         t->xi = t->i;
+         t->xv = 0;
+         t->time = t->ring.time;
+         t->thismax = t->prevmax = peak;
+         P("%zu %.3f  ", t->time, t->thismax);
+         set_message(0.0f, 0.0f, ACFD2_MAX);
+         P("\n");
+      } else {
+         analyze();
+      }
+      hex.message[s] = t->message;
+   }
+   return hex.message;
+}
+
+
+void moly_hex_synth(const float *const in[MOLY_HEX], float *out, size_t size) {
+   size = BLOCK(size);
+   if (g.settings.sample_frequency == 0.0f) return;
+
+   // Read messages
+   for (int s = 0; s < MOLY_HEX; s++) {
+      struct moly_message *m = &hex.message[s];
+      if (m->type == MTYPE_NONE) continue;
+      if (m->volume != 0.0f && m->lambda != 0.0f) {
+         hex.lambda[s] = m->lambda;
+      }
+      if (m->type == MTYPE_TRIG) {
+         hex.vol[s] = 0.0f;
+      }
+      hex.vol_count[s] = RAMP_LENGTH; // 1 ms in the future
+      hex.vol_delta[s] = (g.settings.wetvolume * m->volume - hex.vol[s]) / hex.vol_count[s];
+      hex.vol_state[s] = m->volume != 0.0f;
+      m->type = MTYPE_NONE;
+   }
+
+   // Faded out after silence, as in synthesizer
+   for (int s = 0; s < MOLY_HEX; s++) {
+      if (!hex.vol_state[s] && hex.vol_count[s] < 0) {
+         hex.lambda[s] = 0.0f;
+         hex.vol_delta[s] = 0.0f;
+      }
+   }
+
+   // Silent lanes get phidelta 0 and stay at phi 0
+   phase_t phidelta[HEX_LANES];
+   float active[HEX_LANES];
+   for (int s = 0; s < HEX_LANES; s++) {
+      active[s] = hex.lambda[s] != 0.0f;
+      phidelta[s] = active[s] ? PHASE_STEP(hex.lambda[s]) : 0;
+      if (!active[s]) {
+         hex.phi[s] = 0;
+         hex.vol[s] = 0.0f;
+      }
+   }
+
+   // Run, the square wave of synthesizer without branches
+   for (size_t i = 0; i < size; i++) {
+      float sum = 0.0f;
+      for (int s = 0; s < HEX_LANES; s++) {
+         phase_t phi0 = hex.phi[s];
+         phase_t d = phidelta[s];
+         phase_t phi = phi0 + d;
+#if MOLY_FIXED
+         float x = (float)square_q15(phi0, phi, d) * (1.0f / 32768);
+         hex.phi[s] = phi;
+#else
+         float x =
+            phi < 0.5f ? 1.0f :
+            phi >= 1.0f ? ((phi - 1.0f) - (1.0f - phi0)) / d :
+            phi0 < 0.5f ? ((0.5f - phi0) - (phi - 0.5f)) / d :
+            -1.0f;
+         hex.phi[s] = phi >= 1.0f ? phi - 1.0f : phi;
+#endif
+         int ramp = hex.vol_count[s] >= 0;
+         hex.vol_count[s] -= ramp;
+         hex.vol[s] += ramp ? hex.vol_delta[s] : 0.0f;
+         sum += active[s] * hex.vol[s] * x;
+      }
+      out[i] = sum;
+   }
+
+   for (int s = 0; s < MOLY_HEX; s++) {
+      add_dry(in[s], out, size);
+   }
+}
+
+#endif
+
+
+//================================================================ OFF-LINE ===
+
+
+#ifdef OFFLINE
+
+// For tools that split a long recording in pieces and run the pieces side
+// by side, see moly -j. A piece starts a little early with a fresh state,
+// and moly_digest tells when it has caught up with the one before it.
+
+static size_t seeked;
+
+void moly_seek(size_t time) {
+   seeked = time;
+   struct tracker *all[MOLY_HEX + 1] = {&mono};
+#if MOLY_HEX
+   for (int s = 0; s < MOLY_HEX; s++) {
+      all[s + 1] = &hex.t[s];
+   }
+#endif
+   for (int s = 0; s <= MOLY_HEX; s++) {
+      all[s]->ring.time = all[s]->time = time;
+      all[s]->ring.i = all[s]->i = all[s]->i_previous = time & RING_MASK;
+   }
+#if OCTAVES
+   for (int k = 0; k < OCTAVES; k++) {
+      struct tracker *tr = &pyramid.t[k];
+      tr->ring.time = tr->time = time >> (k + 1);
+      tr->ring.i = tr->i = tr->i_previous = tr->ring.time & RING_MASK;
+   }
+#endif
+}
+
+
+// The longest ring, that of the top octave in bass mode, and one more for
+// the low-pass filters in front of the rings to settle. A piece that starts
+// this early has seen all that the serial run still remembers.
+size_t moly_warmup(void) {
+   return ((size_t)RING_SIZE << OCTAVES) + RING_SIZE;
+}
+
+
+void moly_reset(void) {
+   memset(self, 0, sizeof(*self));
+   t = &mono;
+   seeked = 0;
+}
+
+
+static uint64_t digest;
+
+static void digest_add(const void *p, size_t n) {
+   const uint8_t *b = p;
+   for (size_t k = 0; k < n; k++) {
+      digest = (digest ^ b[k]) * 0x100000001b3; // FNV-1a
+   }
+}
+
+#define DIGEST(x) digest_add(&(x), sizeof(x))
+
+
+// What is only written before it is read, eg level and acf_d2, is left
+// out. The running sums are taken relative to the newest entry, so that
+// they do not depend on where the run started. A tracker that has not
+// been fed, eg the hexaphonic ones in a mono run, only counts as unused.
+static void digest_tracker(struct tracker *tr, size_t start) {
+   bool unused = tr->ring.time == start;
+   DIGEST(unused);
+   if (unused) return;
+   for (int k = 0; k < RING_SIZE; k++) {
+      DIGEST(tr->ring.buf[k]);
+   }
+   for (int k = 0; k < RING_SIZE / D2_STEP; k++) {
+      uint64_t e = tr->ring.e2sum - tr->ring.e2[k];
+      DIGEST(e);
+   }
+   DIGEST(tr->filter);
+   DIGEST(tr->message);
+   DIGEST(tr->ring.i);
+   DIGEST(tr->ring.time);
+   DIGEST(tr->i);
+   DIGEST(tr->i_previous);
+   DIGEST(tr->time);
+   DIGEST(tr->xi);
+   DIGEST(tr->xv);
+   DIGEST(tr->z);
+   DIGEST(tr->trig);
+   DIGEST(tr->locked);
+   DIGEST(tr->prevmax);
+   DIGEST(tr->prevvolume);
+   DIGEST(tr->prevlambda);
+   DIGEST(tr->lambda_raw);
+   DIGEST(tr->lambda_acf);
+   DIGEST(tr->note);
+   if (g.settings.trigwindow != 0.0f) {
+      size_t since = tr->time - tr->trigtime; // Only if shorter matters
+      size_t wt = ms_samples(g.settings.trigwindow, tr->octave);
+      if (since > wt) since = wt;
+      DIGEST(since);
+   }
+
+   // The onset detector remembers the last wavelength through pauses
+   if (g.settings.attack) {
+      size_t recent = tr->ring.time < tr->onset.time + ONSET_HOLD ? tr->onset.time : 0;
+      DIGEST(recent);
+      DIGEST(tr->onset.env);
+      DIGEST(tr->onset.lambda);
+      DIGEST(tr->onset.pending);
+   }
+   if (g.settings.glide) {
+      DIGEST(tr->glide.ref);
+      DIGEST(tr->glide.age);
+      DIGEST(tr->glide.pending);
+      if (tr->glide.pending) DIGEST(tr->glide.lambda);
+   }
+
+   // A stale difference index is rebuilt before it is used again, see
+   // d2index_track. Otherwise the checkpoints that windows can reach.
+   if (tr->d2.lag[1] == 0 || tr->time - tr->d2.time > RING_SLACK) return;
+   DIGEST(tr->d2.lag);
+   DIGEST(tr->d2.upto);
+   DIGEST(tr->d2.time);
+   size_t span = tr->time - tr->d2.start; // Shorter if cut by the budget
+   if (span > (size_t)(ACF_CYCLES * tr->d2.lag[2])) span = ACF_CYCLES * tr->d2.lag[2];
+   DIGEST(span);
+   for (int j = 0; j < 3; j++) {
+      uint16_t upto = tr->d2.upto[j];
+      uint16_t k = (tr->i - span) & ~(D2_STEP - 1) & RING_MASK;
+      // Behind the windows, then only the checkpoints still to come count
+      if (((upto - k) & RING_MASK) > ((tr->i - k) & RING_MASK)) continue;
+      for (; k != upto; k = (k + D2_STEP) & RING_MASK) {
+         uint64_t c = tr->d2.c[j][upto / D2_STEP] - tr->d2.c[j][k / D2_STEP];
+         DIGEST(c);
+      }
+   }
+}
+
+
+uint64_t moly_digest(void) {
+   digest = 0xcbf29ce484222325;
+   digest_tracker(&mono, seeked);
+   DIGEST(g.synth);
+   DIGEST(bank);
+#if MOLY_HEX
+   for (int s = 0; s < MOLY_HEX; s++) {
+      digest_tracker(&hex.t[s], seeked);
+   }
+   DIGEST(hex.message);
+   DIGEST(hex.x1);
+   DIGEST(hex.x2);
+   DIGEST(hex.peak);
+   DIGEST(hex.lambda);
+   DIGEST(hex.phi);
+   DIGEST(hex.vol);
+   DIGEST(hex.vol_delta);
+   DIGEST(hex.vol_count);
+   DIGEST(hex.vol_state);
+#endif
+#if OCTAVES
+   if (g.settings.bass) {
+      for (int k = 0; k < OCTAVES; k++) {
+         digest_tracker(&pyramid.t[k], seeked >> (k + 1));
+      }
+      DIGEST(pyramid.pair);
+   }
+#endif
+   return digest;
+}
+
+#endif
+
+
+// This file is included in the plugin and in C++ code, where the short
+// names would get in the way, eg std::hex.
+#undef g
+#undef mono
+#undef pyramid
+#undef bank
+#undef hex
+#if !MOLY_INSTANCES
+#undef self
+#endif
@@ -20,13 +20,52 @@
 
 \*****************************************************************************/
 
+// Compile time configuration. A pedal build has a fixed configuration, so
+// give these on the command line (or use molysynth.hpp) and the compiler
+// knows the loop bounds. Zero means that it is decided at run time.
+#ifndef MOLY_SAMPLE_RATE
+#define MOLY_SAMPLE_RATE 0   // Hz, must match moly_init if non-zero
+#endif
+#ifndef MOLY_BLOCK_SIZE
+#define MOLY_BLOCK_SIZE 0    // Samples per moly_addtobuf and moly_synth
+#endif
+#ifndef MOLY_LAMBDA_MIN
+#define MOLY_LAMBDA_MIN 30   // Shortest wavelength in samples
+#endif
+#ifndef MOLY_LAMBDA_MAX
+#define MOLY_LAMBDA_MAX 550  // Longest wavelength in samples
+#endif
+#ifndef MOLY_PERIOD
+#define MOLY_PERIOD 480      // Samples per analysis in moly_process
+#endif
+#ifndef MOLY_OCTAVES
+#define MOLY_OCTAVES 0       // Levels below LAMBDA_MAX for MOLY_BASS, eg 2
+#endif
+#ifndef MOLY_HEX
+#define MOLY_HEX 0           // Strings of the hexaphonic mode, eg 6
+#endif
+#ifndef MOLY_FIXED
+#define MOLY_FIXED 0         // 1 for integer audio path, Q15 samples
+#endif
+#ifndef MOLY_INSTANCES
+#define MOLY_INSTANCES 0     // 1 for any number of instances, see moly_select
+#endif
+
 // Pitch tracker
 #define MOLY_TRIGLEVEL   't' // Default 0.08
 #define MOLY_COMPLEVEL   'c' // Default 0.0
+#define MOLY_ATTACK      'a' // Default 0.0, else trig already in moly_addtobuf
+#define MOLY_BASS        'b' // Default 0.0, else down to LAMBDA_MAX << MOLY_OCTAVES
+#define MOLY_GLIDE       'g' // Default 0.0, else pitch at block rate between analyses
+#define MOLY_BUDGET      'k' // Default 0.0, else samples touched per analysis, see quality
+#define MOLY_WINDOW      'l' // Default 0.0, else longest autocorrelation in ms
+#define MOLY_TRIGWINDOW  'i' // Default 0.0, else the same that long after a trig
 
 // Mini synth
 #define MOLY_DRYVOLUME   'd' // Default 0.0
 #define MOLY_WETVOLUME   'w' // Default 1.0
+#define MOLY_RESONANCE   'q' // Default 10.0, Q of the filter bank
+#define MOLY_FILTERBANK  'f' // Default 0.0, else moly_process runs moly_filter
 
 // For use off-line
 #define MOLY_VERBOSE     'v' // off-line only
@@ -49,15 +88,46 @@
 //
 // NOTE 5: The volume can be compressed. The raw volume is also in the message 
 //   just in case someone wants it besides the compressed volume.
+//
+// NOTE 6: With a work budget the tracker steps down to cheaper estimates when
+//   it runs out, rather than taking the time from the audio. The quality
+//   tells how far down it went.
+//
+// NOTE 7: When a note ends, at silence or at the next TRIG, the message that
+//   says so also describes the note that ended. Otherwise note is all 0.
+//   It is added up during the note from what the analysis has anyway.
+//   The autocorrelation averages the pitch over its window, so the vibrato
+//   depth is under-read even with the default window of 16 cycles: about
+//   0.8 of it at 5 Hz and 0.7 at 7 Hz for a 220 Hz tone, and less for
+//   lower tones, faster vibrato or a longer MOLY_WINDOW.
 
 #define MOLY_MTYPE_CONTINUE 1 // No trig
 #define MOLY_MTYPE_TRIG 2 // Trig, a new tone starts
 
+#define MOLY_QUALITY_FULL 0  // The whole analysis
+#define MOLY_QUALITY_SHORT 1 // Fewer cycles in the autocorrelation
+#define MOLY_QUALITY_RAW 2   // Zero crossings only, no autocorrelation
+#define MOLY_QUALITY_HOLD 3  // The previous wavelength again
+
+struct moly_note {
+   size_t start;  // Sample time of the TRIG
+   size_t length; // Samples until it ended
+   size_t attack; // Samples from the TRIG to the peak
+   float peak;    // Highest volume, before compression
+   float decay;   // dB per second after the peak, negative if it fades
+   float lambda;  // Mean wavelength (geometric), 0 if it never locked
+   float vibrato; // Cents, as the amplitude of a sine, read low, see NOTE 7
+   float vibrato_rate; // Hz
+   float periodicity; // 1 is exactly periodic, 0 is noise
+};
+
 struct moly_message {
    int type;
    float lambda; // Wavelength in number of samples
    float volume; // This is the compressed volume
    float volume_raw; // This is the original volume
+   int quality; // MOLY_QUALITY_...
+   struct moly_note note; // See NOTE 7
 };
 
 // The sample frequency is not hardcoded. This means that our code can 
@@ -71,7 +141,66 @@ struct moly_message *moly_analyze(void);
 void moly_synth(const float *in, float *out, size_t bsz);
 void moly_synth_message(struct moly_message *m);
 
+// Or, instead of the mini synth, the filter bank. An effect on the input,
+// band-pass filters on the tracked fundamental and its first harmonics.
+void moly_filter(const float *in, float *out, size_t bsz);
+
 // At any time we can change the settings
 void moly_set(char opt, float val);
 
+#if MOLY_INSTANCES
+// Any number of instances, eg in a plugin host. Each one is moly_size()
+// bytes of zeroed memory that the host allocates, and moly_select makes it
+// the one that all other calls from this thread work on, moly_init too. It
+// is per thread, so instances can run on different threads at once, and
+// one instance can have its analysis on a thread of its own.
+size_t moly_size(void);
+void moly_select(void *instance);
+#endif
+
+// Or all of the above in one call, for any nframes. It is cut in blocks on
+// a grid counted from moly_init, and the analysis runs right here every
+// MOLY_PERIOD samples. So the result only depends on the samples, whether
+// they come a block at a time or a whole file at once, as long as every call
+// is whole blocks. With MOLY_BLOCK_SIZE nframes must be a multiple of it,
+// which is asserted, as moly_addtobuf reads whole blocks. With out NULL
+// only the analysis runs. Every message is copied to messages if not NULL, which has
+// room for nframes / MOLY_PERIOD + 1. Returns the number of messages. Mono
+// only, and on a DSP the analysis must then fit in one block.
+size_t moly_process(const float *in, float *out, size_t nframes,
+   struct moly_message *messages);
+
+#if MOLY_HEX
+// Hexaphonic mode, for divided pickups with one input channel per string.
+// Every string has its own tracker and its own message stream, and the
+// output is the mix of one mini synth per string. The settings are shared.
+void moly_hex_addtobuf(const float *const in[MOLY_HEX], size_t bsz);
+struct moly_message *moly_hex_analyze(void); // Returns MOLY_HEX messages
+void moly_hex_synth(const float *const in[MOLY_HEX], float *out, size_t bsz);
+#endif
+
+#ifdef OFFLINE
+// Off-line only. The work done by the last moly_analyze, per stage, counted
+// in samples (or zero crossing events) touched. For profiling.
+struct moly_stats {
+   int update; // Samples scanned for zero crossings
+   int raw;    // Zero crossing events examined
+   int index;  // Samples added to the difference index
+   int acf;    // Terms and cycles summed in the autocorrelation
+};
+extern struct moly_stats moly_stats;
+
+// Off-line only, for running pieces of one recording side by side. Right
+// after moly_init, moly_seek makes the tracker start at sample time as if
+// it had run from 0. moly_digest is a hash of the whole state that decides
+// what happens from now on. Two runs with the same digest after the same
+// analysis continue the same way. A piece has to start at least
+// moly_warmup samples early to catch up. moly_reset forgets everything, for
+// another fresh start in the same process, and moly_init comes after it.
+void moly_seek(size_t time);
+size_t moly_warmup(void);
+void moly_reset(void);
+uint64_t moly_digest(void);
+#endif
+
 #endif
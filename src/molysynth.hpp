@@ -0,0 +1,66 @@
+#ifndef __MOLYSYNTH_HPP__
+#define __MOLYSYNTH_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "molysynth.h"
+
+// C++ face of Molysynth, for a build with a fixed configuration.
+//
+// The tracker is C and the configuration is given by the MOLY_ macros in
+// molysynth.h. Define them before dragging in the C file and this template
+// makes sure that the C++ side agrees with what was compiled:
+//
+//    #define MOLY_SAMPLE_RATE 48000
+//    #define MOLY_BLOCK_SIZE 48
+//    extern "C" {
+//    #include "src/molysynth.c"
+//    }
+//    #include "src/molysynth.hpp"
+//    moly::Tracker<48000, 48, 30, 550> tracker;
+//
+// With that the compiler knows the block size, ring size, filter
+// coefficients and wavelength bounds as constants. The macros are the real
+// configuration. The template parameters configure nothing, they are only
+// checked against the macros, so two Trackers with other parameters can
+// not be made. There is only one tracker behind it, so only one Tracker
+// object makes sense.
+
+namespace moly {
+
+template <uint32_t SampleRate, size_t BlockSize, int LambdaMin, int LambdaMax>
+class Tracker {
+   static_assert(SampleRate == MOLY_SAMPLE_RATE,
+      "Compile molysynth.c with MOLY_SAMPLE_RATE == SampleRate");
+   static_assert(BlockSize == MOLY_BLOCK_SIZE,
+      "Compile molysynth.c with MOLY_BLOCK_SIZE == BlockSize");
+   static_assert(LambdaMin == MOLY_LAMBDA_MIN && LambdaMax == MOLY_LAMBDA_MAX,
+      "Compile molysynth.c with the same MOLY_LAMBDA_MIN and MOLY_LAMBDA_MAX");
+   static_assert(0 < LambdaMin && LambdaMin < LambdaMax, "Bad lambda range");
+
+public:
+   static constexpr uint32_t sample_rate = SampleRate;
+   static constexpr size_t block_size = BlockSize;
+   static constexpr float lowest_frequency = (float)SampleRate / LambdaMax;
+   static constexpr float highest_frequency = (float)SampleRate / LambdaMin;
+
+   Tracker() { moly_init(SampleRate); }
+
+   // Audio path, exactly one block each
+   void addtobuf(const float *in) { moly_addtobuf(in, BlockSize); }
+   void synth(const float *in, float *out) { moly_synth(in, out, BlockSize); }
+   void filter(const float *in, float *out) { moly_filter(in, out, BlockSize); }
+
+   // Main loop
+   moly_message *analyze() { return moly_analyze(); }
+
+   // Or all of it, n a multiple of BlockSize, see moly_process
+   size_t process(const float *in, float *out, size_t n, moly_message *m = nullptr) {
+      return moly_process(in, out, n, m);
+   }
+   void set(char opt, float val) { moly_set(opt, val); }
+};
+
+}
+
+#endif